@@ -0,0 +1,122 @@
+#ifndef __ALLOCATIONCOUNTER_HEADER__
+#define __ALLOCATIONCOUNTER_HEADER__
+
+#include "JuceHeader.h"
+
+// A debug mode for checking that renders do no heap allocation of their own. Building with
+// JUCEBOUNCER_COUNT_ALLOCATIONS defined counts every malloc, calloc and realloc (and so every
+// operator new) per thread, by wrapping the default malloc zone on OS X and glibc's allocator
+// elsewhere. Without it, counting compiles away and get() is always 0.
+// Only include this from one translation unit, since it may define malloc itself.
+#ifdef JUCEBOUNCER_COUNT_ALLOCATIONS
+
+#include <pthread.h>
+#if JUCE_MAC
+ #include <malloc/malloc.h>
+ #include <mach/mach.h>
+#endif
+
+namespace AllocationCounter {
+  // Per-thread counts live directly in thread-specific slots, since anything fancier could allocate.
+  static pthread_key_t countKey, pauseKey;
+  static bool installed = false;
+
+  inline void add(pthread_key_t key, intptr_t delta) {
+    pthread_setspecific(key, (void *)((intptr_t)pthread_getspecific(key) + delta));
+  }
+
+  inline void count() {
+    if (installed && pthread_getspecific(pauseKey) == nullptr) add(countKey, 1);
+  }
+
+#if JUCE_MAC
+  static void *(*systemMalloc)(malloc_zone_t *, size_t);
+  static void *(*systemCalloc)(malloc_zone_t *, size_t, size_t);
+  static void *(*systemRealloc)(malloc_zone_t *, void *, size_t);
+
+  static void *countingMalloc(malloc_zone_t *zone, size_t size) {
+    count();
+    return systemMalloc(zone, size);
+  }
+
+  static void *countingCalloc(malloc_zone_t *zone, size_t num, size_t size) {
+    count();
+    return systemCalloc(zone, num, size);
+  }
+
+  static void *countingRealloc(malloc_zone_t *zone, void *ptr, size_t size) {
+    count();
+    return systemRealloc(zone, ptr, size);
+  }
+#endif
+
+  inline bool isEnabled() {
+    return true;
+  }
+
+  // Starts counting. Call once, at the start of main().
+  inline void install() {
+    pthread_key_create(&countKey, nullptr);
+    pthread_key_create(&pauseKey, nullptr);
+#if JUCE_MAC
+    malloc_zone_t *zone = malloc_default_zone();
+    vm_protect(mach_task_self(), (vm_address_t)zone, sizeof(malloc_zone_t), 0, VM_PROT_READ | VM_PROT_WRITE);
+    systemMalloc = zone->malloc;
+    systemCalloc = zone->calloc;
+    systemRealloc = zone->realloc;
+    zone->malloc = countingMalloc;
+    zone->calloc = countingCalloc;
+    zone->realloc = countingRealloc;
+#endif
+    installed = true;
+  }
+
+  // The number of allocations made by the calling thread so far.
+  inline juce::int64 get() {
+    return (juce::int64)(intptr_t)pthread_getspecific(countKey);
+  }
+
+  // Stops counting on this thread while in scope, around code that is not ours, such as processBlock().
+  struct ScopedPause {
+    ScopedPause() { add(pauseKey, 1); }
+    ~ScopedPause() { add(pauseKey, -1); }
+  };
+}
+
+#if !JUCE_MAC && defined(__GLIBC__)
+extern "C" {
+  void *__libc_malloc(size_t);
+  void *__libc_calloc(size_t, size_t);
+  void *__libc_realloc(void *, size_t);
+
+  void *malloc(size_t size) {
+    AllocationCounter::count();
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t num, size_t size) {
+    AllocationCounter::count();
+    return __libc_calloc(num, size);
+  }
+
+  void *realloc(void *ptr, size_t size) {
+    AllocationCounter::count();
+    return __libc_realloc(ptr, size);
+  }
+}
+#endif
+
+#else
+
+namespace AllocationCounter {
+  inline bool isEnabled() { return false; }
+  inline void install() {}
+  inline juce::int64 get() { return 0; }
+  struct ScopedPause {
+    ScopedPause() {}
+  };
+}
+
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef __AUDIOBLOCKSINK_HEADER__
+#define __AUDIOBLOCKSINK_HEADER__
+
+#include "JuceHeader.h"
+
+// Receives rendered audio one block at a time, as it comes out of processBlock().
+class AudioBlockSink {
+public:
+  virtual ~AudioBlockSink() {}
+
+  // Consumes the first numSamples of each channel. Returning false aborts the render.
+  virtual bool writeBlock(const juce::AudioSampleBuffer &buffer, int numSamples) = 0;
+};
+
+// Encodes blocks with an AudioFormatWriter, which it owns.
+class AudioWriterSink : public AudioBlockSink {
+public:
+  AudioWriterSink(juce::AudioFormatWriter *_writer) : writer(_writer) {}
+
+  bool writeBlock(const juce::AudioSampleBuffer &buffer, int numSamples) {
+    return writer->writeFromAudioSampleBuffer(buffer, 0 /* offset into buffer */, numSamples);
+  }
+
+private:
+  juce::ScopedPointer<juce::AudioFormatWriter> writer;
+
+  JUCE_DECLARE_NON_COPYABLE(AudioWriterSink)
+};
+
+// Writes a WAV file of a known length as blocks arrive, without ever seeking back. Unlike
+// AudioFormatWriter, which patches its header once done, it writes the whole header up front,
+// so the stream can be a socket. Samples are 16 or 24-bit integers, or 32-bit floats.
+class WavStreamSink : public AudioBlockSink {
+public:
+  static bool supportsBitDepth(int bitDepth) {
+    return bitDepth == 16 || bitDepth == 24 || bitDepth == 32;
+  }
+
+  // The size of the whole file, header included.
+  static juce::int64 getFileSize(int numChannels, int bitDepth, juce::int64 numFrames) {
+    juce::int64 dataSize = numFrames * numChannels * (bitDepth / 8);
+    return 44 + dataSize + (dataSize & 1);
+  }
+
+  WavStreamSink(juce::OutputStream &_ostream, int _sampleRate, int _numChannels, int _bitDepth, juce::int64 _numFrames)
+    : ostream(_ostream), sampleRate(_sampleRate), numChannels(_numChannels), bitDepth(_bitDepth),
+      numFrames(_numFrames), framesWritten(0), headerWritten(false) {}
+
+  // Blocks beyond the announced length are cut short, so the file always matches its header.
+  bool writeBlock(const juce::AudioSampleBuffer &buffer, int numSamples) {
+    if (!headerWritten && !writeHeader()) return false;
+    numSamples = (int)juce::jmin((juce::int64)numSamples, numFrames - framesWritten);
+    if (numSamples <= 0) return true;
+
+    // Samples are interleaved a chunk at a time on the stack, so that writing never allocates.
+    int bytesPerSample = bitDepth / 8, frameBytes = numChannels * bytesPerSample;
+    int chunkFrames = juce::jmax(1, (int)sizeof(interleaved) / frameBytes);
+    for (int start = 0; start < numSamples; start += chunkFrames) {
+      int num = juce::jmin(chunkFrames, numSamples - start);
+      for (int ch = 0; ch < numChannels; ++ch) {
+        const float *src = buffer.getSampleData(ch, start);
+        char *dest = interleaved + ch * bytesPerSample;
+        if (bitDepth == 16) juce::AudioDataConverters::convertFloatToInt16LE(src, dest, num, frameBytes);
+        else if (bitDepth == 24) juce::AudioDataConverters::convertFloatToInt24LE(src, dest, num, frameBytes);
+        else juce::AudioDataConverters::convertFloatToFloat32LE(src, dest, num, frameBytes);
+      }
+      if (!ostream.write(interleaved, (size_t)(num * frameBytes))) return false;
+    }
+    framesWritten += numSamples;
+    return true;
+  }
+
+  // Completes the file once every block has been written: writes the header of an empty render,
+  // and the pad byte that RIFF requires after odd-sized data.
+  bool finish() {
+    if (!headerWritten && !writeHeader()) return false;
+    juce::int64 dataSize = framesWritten * numChannels * (bitDepth / 8);
+    return (dataSize & 1) == 0 || ostream.writeByte(0);
+  }
+
+private:
+  bool writeHeader() {
+    headerWritten = true;
+    juce::int64 dataSize = numFrames * numChannels * (bitDepth / 8);
+    int frameBytes = numChannels * (bitDepth / 8);
+    char header[44];
+    memcpy(header, "RIFF", 4);
+    putLittleEndian(header + 4, (juce::uint32)(getFileSize(numChannels, bitDepth, numFrames) - 8), 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    putLittleEndian(header + 16, 16, 4);
+    putLittleEndian(header + 20, bitDepth == 32 ? 3 /* IEEE float */ : 1 /* PCM */, 2);
+    putLittleEndian(header + 22, (juce::uint32)numChannels, 2);
+    putLittleEndian(header + 24, (juce::uint32)sampleRate, 4);
+    putLittleEndian(header + 28, (juce::uint32)(sampleRate * frameBytes), 4);
+    putLittleEndian(header + 32, (juce::uint32)frameBytes, 2);
+    putLittleEndian(header + 34, (juce::uint32)bitDepth, 2);
+    memcpy(header + 36, "data", 4);
+    putLittleEndian(header + 40, (juce::uint32)dataSize, 4);
+    return ostream.write(header, sizeof(header));
+  }
+
+  static void putLittleEndian(char *dest, juce::uint32 value, int numBytes) {
+    for (int i = 0; i < numBytes; ++i) dest[i] = (char)((value >> (8 * i)) & 0xff);
+  }
+
+  juce::OutputStream &ostream;
+  int sampleRate, numChannels, bitDepth;
+  juce::int64 numFrames, framesWritten;
+  bool headerWritten;
+  char interleaved[8192];
+
+  JUCE_DECLARE_NON_COPYABLE(WavStreamSink)
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __HANDOFFOUTPUTSTREAM_HEADER__
+#define __HANDOFFOUTPUTSTREAM_HEADER__
+
+#include "JuceHeader.h"
+
+// Carries bytes written on other threads over to the thread that created the stream, which alone
+// writes to the destination, such as an HTTP thread that owns a client connection. Up to capacity
+// bytes are buffered, so a slow client only stalls a render thread once its request is that far
+// behind. Writes on the creating thread itself go straight through, after anything still buffered.
+// The buffer is a ring allocated up front, so writing never allocates.
+class HandoffOutputStream : public juce::OutputStream {
+public:
+  HandoffOutputStream(juce::OutputStream &_destination, size_t _capacity)
+    : destination(_destination), fifo((int)_capacity + 1), ring((size_t)_capacity + 1),
+      owner(juce::Thread::getCurrentThreadId()), position(0), failed(false), finished(false) {}
+
+  bool isOwnedByCurrentThread() const {
+    return juce::Thread::getCurrentThreadId() == owner;
+  }
+
+  // Called on the creating thread: sends buffered bytes on as they arrive, until finishWriting().
+  void sendUntilFinished() {
+    for (;;) {
+      bool wasFinished;
+      {
+        const juce::ScopedLock sl(lock);
+        wasFinished = finished;
+      }
+      sendPending();
+      if (wasFinished) return;
+      written.wait(-1);
+    }
+  }
+
+  // Called by the writing thread once it will write no more, even after a failure.
+  void finishWriting() {
+    {
+      const juce::ScopedLock sl(lock);
+      finished = true;
+    }
+    written.signal();
+  }
+
+  void flush() {
+    if (isOwnedByCurrentThread()) {
+      sendPending();
+      destination.flush();
+    }
+  }
+
+  bool write(const void *data, size_t size) {
+    if (isOwnedByCurrentThread()) {
+      bool ok = sendPending() && destination.write(data, size);
+      const juce::ScopedLock sl(lock);
+      if (!ok) failed = true;
+      else position += (juce::int64)size;
+      return ok;
+    }
+
+    // Copy in as much as there is room for, waiting for the rest, so a write larger than the whole
+    // buffer goes through in pieces.
+    const char *bytes = static_cast<const char *>(data);
+    for (size_t remaining = size; remaining > 0;) {
+      {
+        const juce::ScopedLock sl(lock);
+        if (failed) return false;
+      }
+      int start1, size1, start2, size2;
+      fifo.prepareToWrite((int)juce::jmin(remaining, (size_t)fifo.getFreeSpace()), start1, size1, start2, size2);
+      if (size1 + size2 == 0) {
+        sent.wait(100);
+        continue;
+      }
+      memcpy(ring + start1, bytes, (size_t)size1);
+      memcpy(ring + start2, bytes + size1, (size_t)size2);
+      fifo.finishedWrite(size1 + size2);
+      bytes += size1 + size2;
+      remaining -= (size_t)(size1 + size2);
+      written.signal();
+    }
+    const juce::ScopedLock sl(lock);
+    position += (juce::int64)size;
+    return true;
+  }
+
+  bool setPosition(juce::int64) {
+    return false;
+  }
+
+  juce::int64 getPosition() {
+    const juce::ScopedLock sl(lock);
+    return position;
+  }
+
+private:
+  // Called on the creating thread. Returns false once the destination has failed.
+  bool sendPending() {
+    {
+      const juce::ScopedLock sl(lock);
+      if (failed) return false;
+    }
+    for (;;) {
+      int start1, size1, start2, size2;
+      fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+      if (size1 + size2 == 0) return true;
+      bool ok = (size1 == 0 || destination.write(ring + start1, (size_t)size1))
+        && (size2 == 0 || destination.write(ring + start2, (size_t)size2));
+      fifo.finishedRead(size1 + size2);
+      sent.signal();
+      if (!ok) {
+        const juce::ScopedLock sl(lock);
+        failed = true;
+        return false;
+      }
+    }
+  }
+
+  juce::OutputStream &destination;
+  juce::AbstractFifo fifo; // the render thread writes, and the creating thread reads
+  juce::HeapBlock<char> ring;
+  juce::Thread::ThreadID owner;
+  juce::CriticalSection lock;
+  juce::int64 position;
+  bool failed, finished;
+  juce::WaitableEvent written, sent; // auto-reset, so a signal is never lost before its wait
+
+  JUCE_DECLARE_NON_COPYABLE(HandoffOutputStream)
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __MIDISCHEDULE_HEADER__
+#define __MIDISCHEDULE_HEADER__
+
+#include "JuceHeader.h"
+
+// MIDI events for a whole render, timestamped in samples from the start,
+// which are handed to the plugin one block at a time at their exact offsets.
+class MidiSchedule {
+public:
+  MidiSchedule() : blockSize(0), numBlocks(0) {}
+
+  // Keeps the memory of the events and blocks, so that a reused schedule stops allocating.
+  void clear() {
+    events.clear();
+    for (int i = 0; i < numBlocks; ++i) blocks[i]->clear();
+    blockSize = numBlocks = 0;
+  }
+
+  void addEvent(const juce::MidiMessage &message, int samplePosition) {
+    events.addEvent(message, juce::jmax(0, samplePosition));
+  }
+
+  // Pre-splits the events into one buffer per block of the given size, once they have all been added,
+  // so that fetching a block only touches that block's events, however many the render has.
+  void splitIntoBlocks(int _blockSize) {
+    blockSize = _blockSize;
+    juce::MidiBuffer::Iterator iter(events);
+    juce::MidiMessage message;
+    int position;
+    while (iter.getNextEvent(message, position)) {
+      int index = position / blockSize;
+      while (blocks.size() <= index) blocks.add(new juce::MidiBuffer());
+      numBlocks = juce::jmax(numBlocks, index + 1);
+      blocks[index]->addEvent(message, position - index * blockSize);
+    }
+  }
+
+  // Fills dest with the events in [startSample, startSample + numSamples), relative to startSample.
+  void getBlock(int startSample, int numSamples, juce::MidiBuffer &dest) const {
+    dest.clear();
+    if (blockSize > 0) {
+      int index = startSample / blockSize, offset = startSample - index * blockSize;
+      if (offset + numSamples <= blockSize) {
+        if (index < numBlocks) dest.addEvents(*blocks[index], offset, numSamples, -offset);
+        return;
+      }
+    }
+    juce::MidiBuffer::Iterator iter(events);
+    iter.setNextSamplePosition(startSample);
+    juce::MidiMessage message;
+    int position;
+    while (iter.getNextEvent(message, position) && position < startSample + numSamples) {
+      dest.addEvent(message, position - startSample);
+    }
+  }
+
+  // The position of the last event, or -1 if there are none.
+  int getLastEventTime() const {
+    return events.isEmpty() ? -1 : events.getLastEventTime();
+  }
+
+private:
+  juce::MidiBuffer events;
+  juce::OwnedArray<juce::MidiBuffer> blocks; // after splitIntoBlocks(); any beyond numBlocks are spare
+  int blockSize, numBlocks;
+
+  JUCE_DECLARE_NON_COPYABLE(MidiSchedule)
+};
+
+#endif
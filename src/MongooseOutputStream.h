@@ -0,0 +1,52 @@
+#ifndef __MONGOOSEOUTPUTSTREAM_HEADER__
+#define __MONGOOSEOUTPUTSTREAM_HEADER__
+
+#include "JuceHeader.h"
+#include "mongoose.h"
+
+// Writes straight to a mongoose connection. The response headers are held back until the first
+// write, so that a request which fails before producing any output can still be answered with an error.
+class MongooseOutputStream : public juce::OutputStream {
+public:
+  MongooseOutputStream(struct mg_connection *_conn, const juce::String &_headers)
+    : conn(_conn), headers(_headers), headersSent(false), position(0) {}
+
+  // Whether anything, and so the headers, has gone out yet.
+  bool hasStarted() const {
+    return headersSent;
+  }
+
+  void flush() {}
+
+  bool write(const void *buffer, size_t size) {
+    if (!headersSent) {
+      headersSent = true;
+      if (!send(headers.toRawUTF8(), headers.getNumBytesAsUTF8())) return false;
+    }
+    if (size > 0 && !send(buffer, size)) return false;
+    position += size;
+    return true;
+  }
+
+  bool setPosition(juce::int64) {
+    return false; // a socket cannot seek
+  }
+
+  juce::int64 getPosition() {
+    return position;
+  }
+
+private:
+  bool send(const void *buffer, size_t size) {
+    return mg_write(conn, buffer, size) > 0;
+  }
+
+  struct mg_connection *conn;
+  juce::String headers;
+  bool headersSent;
+  juce::int64 position;
+
+  JUCE_DECLARE_NON_COPYABLE(MongooseOutputStream)
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef __PARAMETERAUTOMATION_HEADER__
+#define __PARAMETERAUTOMATION_HEADER__
+
+#include <climits>
+#include "JuceHeader.h"
+
+// Breakpoint curves for plugin parameters, timestamped in samples from the start of the render.
+// Values are interpolated linearly between breakpoints and held before the first and after the
+// last. The render loop splits blocks wherever a value changes, so changes land on exact samples;
+// along a ramp, values are updated every stepSamples.
+class ParameterAutomation {
+public:
+  ParameterAutomation() : numCurves(0), stepSamples(32) {}
+
+  // Keeps the memory of the curves, so that a reused schedule stops allocating.
+  void clear() {
+    numCurves = 0;
+  }
+
+  bool isEmpty() const {
+    return numCurves == 0;
+  }
+
+  void setStepSamples(int step) {
+    stepSamples = juce::jmax(1, step);
+  }
+
+  void addBreakpoint(int parameterIndex, int samplePosition, float value) {
+    Curve *curve = getCurve(parameterIndex);
+    Breakpoint point = { juce::jmax(0, samplePosition), value };
+    int i = curve->points.size();
+    while (i > 0 && curve->points.getReference(i - 1).position > point.position) --i;
+    curve->points.insert(i, point);
+  }
+
+  // The first position after the given one at which some parameter's value changes,
+  // or INT_MAX if none ever does.
+  int getNextChangeAfter(int position) const {
+    int next = INT_MAX;
+    for (int i = 0; i < numCurves; ++i) next = juce::jmin(next, curves[i]->getNextChangeAfter(position, stepSamples));
+    return next;
+  }
+
+  // Sets each automated parameter to its value at the given position, if that differs from the last one set.
+  void apply(juce::AudioPluginInstance *instance, int position) {
+    for (int i = 0; i < numCurves; ++i) {
+      Curve &curve = *curves[i];
+      float value = curve.getValueAt(position);
+      if (curve.hasApplied && value == curve.lastApplied) continue;
+      instance->setParameter(curve.parameterIndex, value);
+      curve.lastApplied = value;
+      curve.hasApplied = true;
+    }
+  }
+
+private:
+  struct Breakpoint {
+    int position;
+    float value;
+  };
+
+  struct Curve {
+    int parameterIndex;
+    juce::Array<Breakpoint> points; // sorted by position
+    float lastApplied;
+    bool hasApplied;
+
+    Curve() : parameterIndex(-1), lastApplied(0), hasApplied(false) {}
+
+    float getValueAt(int position) const {
+      int n = points.size();
+      if (position <= points.getReference(0).position) return points.getReference(0).value;
+      for (int i = 1; i < n; ++i) {
+        const Breakpoint &a = points.getReference(i - 1), &b = points.getReference(i);
+        if (position < b.position) {
+          return a.value + (b.value - a.value) * (float)(position - a.position) / (float)(b.position - a.position);
+        }
+      }
+      return points.getReference(n - 1).value;
+    }
+
+    int getNextChangeAfter(int position, int step) const {
+      for (int i = 0; i < points.size(); ++i) {
+        const Breakpoint &b = points.getReference(i);
+        if (b.position <= position) continue;
+        // Before the first breakpoint, or along a flat segment, nothing changes until the breakpoint.
+        if (i == 0 || points.getReference(i - 1).value == b.value) return b.position;
+        return juce::jmin(b.position, position + step);
+      }
+      return INT_MAX;
+    }
+  };
+
+  Curve *getCurve(int parameterIndex) {
+    for (int i = 0; i < numCurves; ++i) {
+      if (curves[i]->parameterIndex == parameterIndex) return curves[i];
+    }
+    if (numCurves == curves.size()) curves.add(new Curve());
+    Curve *curve = curves[numCurves++];
+    curve->parameterIndex = parameterIndex;
+    curve->points.clearQuick();
+    curve->hasApplied = false;
+    return curve;
+  }
+
+  juce::OwnedArray<Curve> curves; // any beyond numCurves are spare
+  int numCurves;
+  int stepSamples;
+
+  JUCE_DECLARE_NON_COPYABLE(ParameterAutomation)
+};
+
+#endif
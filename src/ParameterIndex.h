@@ -0,0 +1,53 @@
+#ifndef __PARAMETERINDEX_HEADER__
+#define __PARAMETERINDEX_HEADER__
+
+#include "JuceHeader.h"
+
+// A plugin's parameter indices by name, read from one instance when the plugin loads, so that
+// applying a request's parameters costs only the parameters it names. Names may repeat, in which
+// case getFirstIndex() and getNextIndex() visit every parameter with the name, in order.
+class ParameterIndex {
+public:
+  explicit ParameterIndex(juce::AudioPluginInstance *instance) {
+    juce::HashMap<juce::String, int> lastIndices;
+    for (int i = 0, n = instance->getNumParameters(); i < n; ++i) {
+      juce::String name = instance->getParameterName(i);
+      nextWithSameName.add(-1);
+      if (!lastIndices.contains(name)) firstIndices.set(name, i);
+      else nextWithSameName.set(lastIndices[name], i);
+      lastIndices.set(name, i);
+    }
+  }
+
+  int size() const {
+    return nextWithSameName.size();
+  }
+
+  // The first parameter with the given name, or -1 if there is none.
+  int getFirstIndex(const juce::String &name) const {
+    return firstIndices.contains(name) ? firstIndices[name] : -1;
+  }
+
+  // The next parameter with the same name as the given one, or -1 if there is none.
+  int getNextIndex(int index) const {
+    return nextWithSameName[index];
+  }
+
+  // Returns true if every name in the set is a parameter's, and otherwise adds the others to unknown.
+  bool hasAllNames(const juce::NamedValueSet &parameters, juce::StringArray &unknown) const {
+    int numUnknown = unknown.size();
+    for (int j = 0; j < parameters.size(); ++j) {
+      juce::String name = parameters.getName(j).toString();
+      if (!firstIndices.contains(name)) unknown.add(name);
+    }
+    return unknown.size() == numUnknown;
+  }
+
+private:
+  juce::HashMap<juce::String, int> firstIndices;
+  juce::Array<int> nextWithSameName;
+
+  JUCE_DECLARE_NON_COPYABLE(ParameterIndex)
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef __PARAMETERLISTCACHE_HEADER__
+#define __PARAMETERLISTCACHE_HEADER__
+
+#include "JuceHeader.h"
+#include "ParameterIndex.h"
+
+// What parameter listings report, captured from an instance once and then answered without one.
+// Each plugin version's parameter and preset names are read once, and the parameter values of each
+// of its presets are snapshotted the first time that preset is listed. A request's own parameters
+// are then patched over the snapshot.
+class ParameterListCache {
+public:
+  // The names of one plugin version, which do not depend on the preset.
+  struct Metadata : public juce::ReferenceCountedObject {
+    typedef juce::ReferenceCountedObjectPtr<Metadata> Ptr;
+    juce::String version;
+    juce::Array<juce::Identifier> parameterNames;
+    juce::ScopedPointer<ParameterIndex> parameterIndex; // for patching requested values over a snapshot
+    juce::StringArray programNames;
+
+    // The program that pluginProgramAndParametersSet() ends up in for a preset number.
+    int getProgram(int presetNumber) const {
+      return presetNumber >= 0 && presetNumber < programNames.size() ? presetNumber : 0;
+    }
+  };
+
+  // The parameter values of one preset, just after it is loaded.
+  struct Snapshot : public juce::ReferenceCountedObject {
+    typedef juce::ReferenceCountedObjectPtr<Snapshot> Ptr;
+    Metadata::Ptr metadata;
+    int program;
+    juce::Array<float> values;
+    juce::String json; // the listing with nothing patched over
+
+    // The listing, as {parameters, indexedParameters, presets}, with the given values.
+    // All DynamicObjects created are freed when the returned var leaves scope.
+    juce::var describe(const juce::Array<float> &_values) const {
+      juce::DynamicObject *outer = new juce::DynamicObject();
+      juce::var outerVar(outer);
+      juce::DynamicObject *innerParams = new juce::DynamicObject();
+      outer->setProperty("parameters", juce::var(innerParams));
+      juce::var indexedParamVar;
+      for (int i = 0; i < _values.size(); ++i) {
+        const juce::Identifier &name = metadata->parameterNames.getReference(i);
+        float val = _values.getUnchecked(i);
+        innerParams->setProperty(name, val);
+
+        juce::DynamicObject *indexedInnerObj = new juce::DynamicObject();
+        indexedInnerObj->setProperty("index", i);
+        indexedInnerObj->setProperty("name", name.toString());
+        indexedInnerObj->setProperty("value", val);
+        indexedParamVar.append(juce::var(indexedInnerObj));
+      }
+      outer->setProperty("indexedParameters", indexedParamVar);
+
+      juce::var progVar;
+      for (int i = 0; i < metadata->programNames.size(); ++i) progVar.append(juce::var(metadata->programNames[i]));
+      outer->setProperty("presets", progVar);
+      return outerVar;
+    }
+  };
+
+  ParameterListCache() {}
+
+  // Returns the snapshot of the given plugin version and preset, or nullptr if there is none yet.
+  Snapshot::Ptr get(const juce::String &version, int presetNumber) {
+    const juce::ScopedLock sl(lock);
+    Metadata *found = findMetadata(version);
+    return found ? findSnapshot(found, found->getProgram(presetNumber)) : nullptr;
+  }
+
+  // Snapshots an instance that has just had the preset loaded, and nothing else set. The snapshot is
+  // kept unless the version is empty, replacing anything kept for other versions of the plugin.
+  Snapshot::Ptr add(const juce::String &version, int presetNumber, juce::AudioPluginInstance *instance) {
+    Metadata::Ptr found;
+    {
+      const juce::ScopedLock sl(lock);
+      found = findMetadata(version);
+    }
+    if (!found) {
+      found = new Metadata();
+      found->version = version;
+      for (int i = 0, n = instance->getNumParameters(); i < n; ++i) {
+        found->parameterNames.add(juce::Identifier(instance->getParameterName(i)));
+      }
+      found->parameterIndex = new ParameterIndex(instance);
+      for (int i = 0, n = instance->getNumPrograms(); i < n; ++i) found->programNames.add(instance->getProgramName(i));
+    }
+
+    Snapshot::Ptr snapshot = new Snapshot();
+    snapshot->metadata = found;
+    snapshot->program = found->getProgram(presetNumber);
+    for (int i = 0; i < found->parameterNames.size(); ++i) snapshot->values.add(instance->getParameter(i));
+    snapshot->json = juce::JSON::toString(snapshot->describe(snapshot->values));
+
+    if (version.isEmpty()) return snapshot;
+    const juce::ScopedLock sl(lock);
+    Metadata *stored = findMetadata(version);
+    if (!stored) {
+      removeOtherVersions(version);
+      metadata.add(found);
+      stored = found;
+    }
+    // Another thread may have got here first, in which case its snapshot is kept.
+    if (stored == (Metadata *)found && !findSnapshot(stored, snapshot->program)) snapshots.add(snapshot);
+    return snapshot;
+  }
+
+private:
+  // These must be called under the lock.
+  Metadata *findMetadata(const juce::String &version) const {
+    for (int i = 0; i < metadata.size(); ++i) {
+      if (metadata.getUnchecked(i)->version == version) return metadata.getUnchecked(i);
+    }
+    return nullptr;
+  }
+
+  Snapshot *findSnapshot(const Metadata *owner, int program) const {
+    for (int i = 0; i < snapshots.size(); ++i) {
+      Snapshot *snapshot = snapshots.getUnchecked(i);
+      if ((const Metadata *)snapshot->metadata == owner && snapshot->program == program) return snapshot;
+    }
+    return nullptr;
+  }
+
+  // Versions are "name@fingerprint", so a rebuilt plugin's new version replaces its old one.
+  void removeOtherVersions(const juce::String &version) {
+    juce::String prefix = version.upToLastOccurrenceOf("@", true, false);
+    for (int i = snapshots.size(); --i >= 0;) {
+      if (snapshots.getUnchecked(i)->metadata->version.startsWith(prefix)) snapshots.remove(i);
+    }
+    for (int i = metadata.size(); --i >= 0;) {
+      if (metadata.getUnchecked(i)->version.startsWith(prefix)) metadata.remove(i);
+    }
+  }
+
+  juce::CriticalSection lock;
+  juce::ReferenceCountedArray<Metadata> metadata;
+  juce::ReferenceCountedArray<Snapshot> snapshots;
+
+  JUCE_DECLARE_NON_COPYABLE(ParameterListCache)
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __PLUGINDESCRIPTIONCACHE_HEADER__
+#define __PLUGINDESCRIPTIONCACHE_HEADER__
+
+#include "JuceHeader.h"
+
+// Identifies one version of a plugin on disk. Plugins are often bundles (directories),
+// so the size is summed over every file inside and the latest modification time is used.
+struct PluginFileFingerprint {
+  juce::int64 modificationTime, size;
+
+  PluginFileFingerprint() : modificationTime(0), size(0) {}
+
+  explicit PluginFileFingerprint(const juce::File &file) : modificationTime(0), size(0) {
+    add(file);
+    if (file.isDirectory()) {
+      juce::DirectoryIterator iter(file, true, "*", juce::File::findFilesAndDirectories);
+      while (iter.next()) add(iter.getFile());
+    }
+  }
+
+  bool operator==(const PluginFileFingerprint &other) const {
+    return modificationTime == other.modificationTime && size == other.size;
+  }
+
+  juce::String toString() const {
+    return juce::String::toHexString(modificationTime) + "-" + juce::String::toHexString(size);
+  }
+
+private:
+  void add(const juce::File &file) {
+    modificationTime = juce::jmax(modificationTime, file.getLastModificationTime().toMilliseconds());
+    if (!file.isDirectory()) size += file.getSize();
+  }
+};
+
+// Remembers the PluginDescription scanned from each plugin file, keyed by path, modification time
+// and size, and persists them to an XML file so that restarts can skip scanning altogether.
+class PluginDescriptionCache {
+public:
+  PluginDescriptionCache() : entries(new juce::XmlElement("PLUGINCACHE")) {}
+
+  // Reads any previously saved descriptions. A missing or unreadable file just means an empty cache.
+  void setFile(const juce::File &_file) {
+    const juce::ScopedLock sl(lock);
+    file = _file;
+    entries = juce::XmlDocument::parse(file);
+    if (!entries || !entries->hasTagName("PLUGINCACHE")) entries = new juce::XmlElement("PLUGINCACHE");
+  }
+
+  // Fills in the description of the plugin at the given path, scanning it only if the cache
+  // has no description for its current fingerprint. Returns false if no format recognises it.
+  // Fingerprinting walks the whole bundle, so callers that already have the fingerprint pass it in.
+  bool getDescription(juce::AudioPluginFormatManager &formatManager, const juce::String &path,
+                      juce::PluginDescription &desc, const juce::String &knownFingerprint = juce::String::empty) {
+    juce::String fingerprint = knownFingerprint.isNotEmpty() ? knownFingerprint
+                                                             : PluginFileFingerprint((juce::File(path))).toString();
+
+    {
+      const juce::ScopedLock sl(lock);
+      juce::XmlElement *entry = findEntry(path);
+      if (entry && entry->getStringAttribute("fingerprint") == fingerprint
+          && entry->getFirstChildElement() && desc.loadFromXml(*entry->getFirstChildElement())) {
+        return true;
+      }
+    }
+
+    // Scan outside the lock, since loading the plugin's code can be slow.
+    juce::Logger::writeToLog("Scanning plugin " + path);
+    juce::OwnedArray<juce::PluginDescription> found;
+    for (int i = 0; i < formatManager.getNumFormats() && found.size() == 0; ++i) {
+      formatManager.getFormat(i)->findAllTypesForFile(found, path);
+    }
+    if (found.size() == 0) return false;
+    desc = *found.getFirst();
+
+    const juce::ScopedLock sl(lock);
+    juce::XmlElement *entry = findEntry(path);
+    if (!entry) {
+      entry = entries->createNewChildElement("ENTRY");
+      entry->setAttribute("path", path);
+    }
+    entry->setAttribute("fingerprint", fingerprint);
+    entry->deleteAllChildElements();
+    entry->addChildElement(desc.createXml());
+    save();
+    return true;
+  }
+
+private:
+  juce::XmlElement *findEntry(const juce::String &path) const {
+    forEachXmlChildElementWithTagName(*entries, entry, "ENTRY") {
+      if (entry->getStringAttribute("path") == path) return entry;
+    }
+    return nullptr;
+  }
+
+  void save() {
+    if (file == juce::File::nonexistent) return;
+    file.getParentDirectory().createDirectory();
+    if (!entries->writeToFile(file, juce::String::empty)) {
+      juce::Logger::writeToLog("Unable to write plugin cache: " + file.getFullPathName());
+    }
+  }
+
+  juce::CriticalSection lock;
+  juce::File file;
+  juce::ScopedPointer<juce::XmlElement> entries;
+
+  JUCE_DECLARE_NON_COPYABLE(PluginDescriptionCache)
+};
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef __PLUGINPOOL_HEADER__
+#define __PLUGINPOOL_HEADER__
+
+#include "JuceHeader.h"
+#include "ParameterIndex.h"
+
+// The playback configuration an instance was last prepared for.
+struct PluginConfiguration {
+  double sampleRate;
+  int blockSize, nChannels;
+
+  PluginConfiguration(double _sampleRate = 0, int _blockSize = 0, int _nChannels = 0)
+    : sampleRate(_sampleRate), blockSize(_blockSize), nChannels(_nChannels) {}
+
+  // New instances are prepared for the default request configuration,
+  // so that the common case never has to prepare again.
+  static PluginConfiguration initial() { return PluginConfiguration(44100, 2056, 2); }
+
+  bool operator==(const PluginConfiguration &other) const {
+    return sampleRate == other.sampleRate && blockSize == other.blockSize && nChannels == other.nChannels;
+  }
+  bool operator!=(const PluginConfiguration &other) const { return !operator==(other); }
+};
+
+class PluginPool;
+
+struct ThreadSafePlugin {
+  juce::CriticalSection crit;
+  juce::ScopedPointer<juce::AudioPluginInstance> instance;
+  PluginPool *owner;         // nullptr unless pooled
+  juce::uint32 lastReleased; // Time::getMillisecondCounter(), maintained by the pool
+  bool quarantined;          // maintained by the pool
+  int homeThread;            // the render thread this instance always runs on, or -1 if not yet assigned
+  PluginConfiguration prepared; // assumes the instance was prepared with PluginConfiguration::initial()
+  const ParameterIndex *parameterIndex; // of the plugin's registry entry, set whenever a request acquires it
+
+  // The state of the instance right after creation, which pooled instances are restored to between requests.
+  juce::MemoryBlock baselineState;
+  juce::Array<float> baselineParameters;
+  int baselineProgram;
+
+  ThreadSafePlugin(juce::AudioPluginInstance *_instance)
+    : instance(_instance), owner(nullptr), lastReleased(0), quarantined(false), homeThread(-1),
+      prepared(PluginConfiguration::initial()), parameterIndex(nullptr), baselineProgram(0) {}
+
+  // Prepares the instance for non-realtime rendering, skipping prepareToPlay()
+  // if it is already prepared for this configuration.
+  void prepare(const PluginConfiguration &config) {
+    const juce::ScopedLock sl(crit);
+    instance->setNonRealtime(true);
+    if (config != prepared) {
+      instance->prepareToPlay(config.sampleRate, config.blockSize);
+      instance->setNonRealtime(true);
+      prepared = config;
+    }
+  }
+
+  void captureBaseline() {
+    const juce::ScopedLock sl(crit);
+    baselineState.setSize(0);
+    instance->getStateInformation(baselineState);
+    baselineProgram = instance->getCurrentProgram();
+    baselineParameters.clearQuick();
+    for (int i = 0, n = instance->getNumParameters(); i < n; ++i) {
+      baselineParameters.add(instance->getParameter(i));
+    }
+  }
+
+  // Restores the baseline state and returns whether every parameter (and the program) reads back
+  // as it did at creation. Plugins are free to ignore parts of a state blob, so a failure means
+  // the instance can no longer be trusted to behave like a fresh one.
+  bool restoreBaseline() {
+    const juce::ScopedLock sl(crit);
+    if (baselineState.getSize() > 0) {
+      instance->setStateInformation(baselineState.getData(), (int)baselineState.getSize());
+    }
+    instance->reset();
+
+    if (instance->getCurrentProgram() != baselineProgram) return false;
+    if (instance->getNumParameters() != baselineParameters.size()) return false;
+    for (int i = 0; i < baselineParameters.size(); ++i) {
+      if (std::abs(instance->getParameter(i) - baselineParameters.getUnchecked(i)) > 1.0e-4f) return false;
+    }
+    return true;
+  }
+
+  // Swaps in a new instance (deleting the old one) and captures its baseline.
+  void replaceInstance(juce::AudioPluginInstance *newInstance) {
+    const juce::ScopedLock sl(crit);
+    instance = newInstance;
+    prepared = PluginConfiguration::initial();
+    captureBaseline();
+  }
+};
+
+// Creates instances on behalf of a pool when it needs to grow.
+struct PluginInstanceFactory {
+  virtual ~PluginInstanceFactory() {}
+  // Returns a new, prepared instance owned by the caller, or nullptr on failure.
+  virtual juce::AudioPluginInstance *createInstance() = 0;
+  // Called on the pool's thread once it has grown by an instance.
+  virtual void poolGrew() {}
+};
+
+// Returns the number of milliseconds until the given Time::getMillisecondCounter() deadline,
+// which may be negative. The subtraction is done unsigned so that counter wraparound is harmless.
+inline int millisecondsUntil(juce::uint32 deadline) {
+  return (int)(deadline - juce::Time::getMillisecondCounter());
+}
+
+// Owns a set of plugin instances and hands them out to request threads.
+// Requests that find no idle instance join a FIFO wait queue, and a released instance
+// is passed directly to the oldest waiter, so no thread has to poll and none can be starved.
+// Once started, a background thread grows the pool (up to maxSize) while requests queue up,
+// deletes instances (down to minSize) that have sat idle for too long, and replaces quarantined ones.
+class PluginPool : private juce::Thread {
+public:
+  struct Limits {
+    int minSize, maxSize;
+    int growQueueDepth;  // grow when at least this many requests are waiting...
+    int growWaitMillis;  // ...or when the oldest one has waited this long
+    int idleMillis;      // reap instances idle for longer than this
+
+    Limits() : minSize(0), maxSize(1), growQueueDepth(2), growWaitMillis(100), idleMillis(60000) {}
+  };
+
+  PluginPool() : juce::Thread("pool autoscaler"), factory(nullptr), pendingReplacements(0) {}
+
+  ~PluginPool() {
+    stopAutoscaling();
+    // A quarantined instance may still be stuck inside processBlock on another thread, so it is leaked.
+    quarantined.clear(false);
+    // Any waiters still queued at this point belong to threads that mongoose has already stopped.
+    jassert(waiters.size() == 0);
+  }
+
+  // Starts the background thread that grows and shrinks the pool within the given limits.
+  // The factory must outlive the pool, or at least the call to stopAutoscaling().
+  void startAutoscaling(const Limits &_limits, PluginInstanceFactory *_factory) {
+    {
+      const juce::ScopedLock sl(lock);
+      limits = _limits;
+      factory = _factory;
+    }
+    startThread();
+  }
+
+  void stopAutoscaling() {
+    stopThread(10000);
+  }
+
+  // Takes ownership of the plugin, captures its baseline state and makes it available to waiting requests.
+  void add(ThreadSafePlugin *plugin) {
+    plugin->captureBaseline();
+    {
+      const juce::ScopedLock sl(lock);
+      plugin->owner = this;
+      plugins.add(plugin);
+    }
+    release(plugin);
+  }
+
+  // Blocks until an instance is assigned to this thread, or returns nullptr once the
+  // Time::getMillisecondCounter() deadline has passed. The caller must release() the instance.
+  // Among idle instances, the most recently used one already prepared for the given
+  // configuration is preferred; queued requests are served strictly in order.
+  ThreadSafePlugin *acquire(juce::uint32 deadline, const PluginConfiguration &preferred = PluginConfiguration::initial()) {
+    Waiter waiter;
+    {
+      const juce::ScopedLock sl(lock);
+      if (waiters.size() == 0 && idle.size() > 0) {
+        int index = idle.size() - 1;
+        for (int i = index; i >= 0; --i) {
+          if (idle.getUnchecked(i)->prepared == preferred) { index = i; break; }
+        }
+        return idle.removeAndReturn(index);
+      }
+      waiter.enqueued = juce::Time::getMillisecondCounter();
+      waiters.add(&waiter);
+    }
+    notify(); // let the autoscaler know that there is demand
+
+    for (;;) {
+      int remaining = millisecondsUntil(deadline);
+      if (remaining > 0) waiter.event.wait(remaining);
+
+      // The grant and the timeout are both decided under the lock,
+      // so an instance released at the last moment is never lost.
+      const juce::ScopedLock sl(lock);
+      if (waiter.granted) return waiter.granted;
+      if (millisecondsUntil(deadline) <= 0) {
+        waiters.removeFirstMatchingValue(&waiter);
+        return nullptr;
+      }
+    }
+  }
+
+  // Returns an instance, handing it straight to the oldest waiting request if there is one.
+  // Quarantined instances are deleted instead.
+  void release(ThreadSafePlugin *plugin) {
+    juce::ScopedPointer<ThreadSafePlugin> toDelete; // deleted after the lock is released
+    const juce::ScopedLock sl(lock);
+    if (plugin->quarantined) {
+      quarantined.removeObject(plugin, false);
+      toDelete = plugin;
+      return;
+    }
+    plugin->lastReleased = juce::Time::getMillisecondCounter();
+    if (waiters.size() > 0) {
+      Waiter *waiter = waiters.removeAndReturn(0);
+      waiter->granted = plugin;
+      waiter->event.signal();
+    }
+    else {
+      idle.add(plugin);
+    }
+  }
+
+  // Takes a leased instance out of service, because it has hung or is too slow to be trusted.
+  // It no longer counts towards the pool's size, a replacement is created in the background,
+  // and the instance itself is deleted if and when its lease is released.
+  void quarantine(ThreadSafePlugin *plugin) {
+    {
+      const juce::ScopedLock sl(lock);
+      if (plugin->quarantined || !plugins.contains(plugin)) return;
+      plugin->quarantined = true;
+      plugins.removeObject(plugin, false);
+      quarantined.add(plugin);
+      ++pendingReplacements;
+    }
+    juce::Logger::writeToLog("Quarantined a plugin instance, " + juce::String(size()) + " remain in the pool");
+    notify();
+  }
+
+  int size() const {
+    const juce::ScopedLock sl(lock);
+    return plugins.size();
+  }
+
+  int getNumWaiting() const {
+    const juce::ScopedLock sl(lock);
+    return waiters.size();
+  }
+
+private:
+  struct Waiter {
+    juce::WaitableEvent event;
+    ThreadSafePlugin *granted;
+    juce::uint32 enqueued;
+
+    Waiter() : granted(nullptr), enqueued(0) {}
+  };
+
+  enum { AUTOSCALE_INTERVAL_MS = 50 };
+
+  bool shouldGrow() const {
+    const juce::ScopedLock sl(lock);
+    if (!factory || plugins.size() >= limits.maxSize) return false;
+    if (pendingReplacements > 0) return true;
+    if (waiters.size() == 0) return false;
+    if (plugins.size() < limits.minSize || plugins.size() == 0) return true;
+    return waiters.size() >= limits.growQueueDepth
+        || juce::Time::getMillisecondCounter() - waiters.getFirst()->enqueued >= (juce::uint32)limits.growWaitMillis;
+  }
+
+  // Removes at most one instance that has been idle for too long, and returns it for deletion.
+  ThreadSafePlugin *takeExpiredIdle() {
+    const juce::ScopedLock sl(lock);
+    if (plugins.size() <= limits.minSize) return nullptr;
+    juce::uint32 now = juce::Time::getMillisecondCounter();
+    for (int i = 0; i < idle.size(); ++i) {
+      ThreadSafePlugin *plugin = idle.getUnchecked(i);
+      if (now - plugin->lastReleased >= (juce::uint32)limits.idleMillis) {
+        idle.remove(i);
+        plugins.removeObject(plugin, false);
+        return plugin;
+      }
+    }
+    return nullptr;
+  }
+
+  void run() {
+    while (!threadShouldExit()) {
+      // Instantiation and deletion happen outside the lock, since both can be slow.
+      if (shouldGrow()) {
+        juce::AudioPluginInstance *instance = factory->createInstance();
+        if (instance) {
+          {
+            const juce::ScopedLock sl(lock);
+            if (pendingReplacements > 0) --pendingReplacements;
+          }
+          add(new ThreadSafePlugin(instance));
+          juce::Logger::writeToLog("Pool grew to " + juce::String(size()) + " instances");
+          factory->poolGrew();
+          continue; // re-check immediately in case the queue is still deep
+        }
+      }
+
+      juce::ScopedPointer<ThreadSafePlugin> expired(takeExpiredIdle());
+      if (expired) {
+        expired = nullptr;
+        juce::Logger::writeToLog("Pool shrank to " + juce::String(size()) + " instances");
+        continue;
+      }
+
+      wait(AUTOSCALE_INTERVAL_MS);
+    }
+  }
+
+  Limits limits;
+  PluginInstanceFactory *factory;
+  juce::CriticalSection lock;
+  juce::OwnedArray<ThreadSafePlugin> plugins;
+  juce::OwnedArray<ThreadSafePlugin> quarantined; // out of service, but possibly still inside processBlock
+  int pendingReplacements;
+  juce::Array<ThreadSafePlugin *> idle;
+  juce::Array<Waiter *> waiters; // oldest first
+
+  JUCE_DECLARE_NON_COPYABLE(PluginPool)
+};
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef __PLUGINREGISTRY_HEADER__
+#define __PLUGINREGISTRY_HEADER__
+
+#include "JuceHeader.h"
+#include "PluginDescriptionCache.h"
+#include "PluginPool.h"
+#include "PrewarmedInstances.h"
+
+// Creates a prepared instance of the plugin at the given path, whose file has the given fingerprint
+// (or an empty one if unknown), or returns nullptr.
+typedef juce::AudioPluginInstance *(*CreatePluginInstanceFunction)(const juce::String &path,
+                                                                    const juce::String &fingerprint);
+
+// How instances of a plugin are managed once it is loaded.
+struct PluginSettings {
+  PluginPool::Limits poolLimits; // a maxSize of 0 creates a fresh instance for every request
+  int prewarmCount;              // fresh instances kept ready when there is no pool
+  int memoryMB;                  // estimated footprint of one instance, for the memory budget
+
+  PluginSettings() : prewarmCount(0), memoryMB(64) {}
+};
+
+// One plugin known to the registry, along with its instances while it is loaded.
+// The loaded state is only modified under the registry's lock.
+struct PluginEntry : public PluginInstanceFactory {
+  juce::String name, path;
+  bool preload, isDefault;
+  bool independentVoices; // notes never interact (no shared effects), so they may render separately
+  PluginSettings settings;
+
+  juce::ScopedPointer<juce::AudioPluginInstance> residentInstance; // keeps the plugin's code cached
+  juce::ScopedPointer<PluginPool> pool;                            // if pooling
+  juce::ScopedPointer<PrewarmedInstances> prewarmed;               // if not pooling
+  bool loaded;
+  int activeRequests;
+  juce::uint32 lastUsed;
+  juce::String fingerprint; // of the plugin's file, taken at each load; empty until loaded or first needed
+  juce::ScopedPointer<ParameterIndex> parameterIndex; // built at each load, and kept while unloaded
+  int numChannels; // the most channels an instance takes in or puts out, read at each load
+  juce::Atomic<int> grown; // set when the pool grows, until the registry has checked its budget again
+  juce::CriticalSection loadLock; // serializes loading of this entry only
+
+  // Reads a JSON plugin description. Missing settings fall back to the given defaults.
+  PluginEntry(const juce::var &config, const juce::String &defaultName, const PluginSettings &defaults,
+              CreatePluginInstanceFunction _createFunction)
+    : preload(false), isDefault(false), independentVoices(false), settings(defaults),
+      loaded(false), activeRequests(0), lastUsed(0), numChannels(0), createFunction(_createFunction) {
+    #define PLUGIN_ENTRY_SETTING(field, name) \
+      if (!config[#name].isVoid()) {field = config[#name];}
+    name = config["name"].isVoid() ? defaultName : config["name"].toString();
+    path = config["path"].toString();
+    PLUGIN_ENTRY_SETTING(preload, preload)
+    PLUGIN_ENTRY_SETTING(isDefault, default)
+    PLUGIN_ENTRY_SETTING(independentVoices, independentVoices)
+    PLUGIN_ENTRY_SETTING(settings.poolLimits.minSize, poolMin)
+    PLUGIN_ENTRY_SETTING(settings.poolLimits.maxSize, poolMax)
+    PLUGIN_ENTRY_SETTING(settings.poolLimits.growQueueDepth, poolGrowQueueDepth)
+    PLUGIN_ENTRY_SETTING(settings.poolLimits.growWaitMillis, poolGrowWaitMillis)
+    PLUGIN_ENTRY_SETTING(settings.poolLimits.idleMillis, poolIdleMillis)
+    PLUGIN_ENTRY_SETTING(settings.prewarmCount, prewarmCount)
+    PLUGIN_ENTRY_SETTING(settings.memoryMB, memoryMB)
+    #undef PLUGIN_ENTRY_SETTING
+
+    if (settings.poolLimits.maxSize > 0 && settings.poolLimits.minSize > settings.poolLimits.maxSize) {
+      settings.poolLimits.minSize = settings.poolLimits.maxSize;
+    }
+  }
+
+  juce::AudioPluginInstance *createInstance() {
+    return createFunction(path, fingerprint);
+  }
+
+  // The budget is checked on a request's thread, since unloading a plugin stops its pool's thread.
+  void poolGrew() {
+    grown = 1;
+  }
+
+  // The estimated memory held by this entry's live instances, in megabytes.
+  int getFootprintMB() const {
+    if (!loaded) return 0;
+    int numInstances = (residentInstance ? 1 : 0) + (pool ? pool->size() : 0)
+      + (prewarmed ? settings.prewarmCount : 0);
+    return numInstances * settings.memoryMB;
+  }
+
+private:
+  CreatePluginInstanceFunction createFunction;
+
+  JUCE_DECLARE_NON_COPYABLE(PluginEntry)
+};
+
+// The set of plugins this server can render with, read from a directory of JSON descriptions.
+// Plugins are loaded on first use (or at startup if marked "preload"), and when the estimated
+// footprint of all loaded plugins exceeds the memory budget, the least recently used plugins
+// that are not serving a request are unloaded.
+class PluginRegistry {
+public:
+  PluginRegistry() : memoryBudgetMB(0), defaultEntry(nullptr) {}
+
+  ~PluginRegistry() {
+    unloadAll();
+  }
+
+  // Adds a plugin description. The first entry, or the one marked "default", serves requests
+  // that do not name a plugin.
+  void add(PluginEntry *entry) {
+    const juce::ScopedLock sl(lock);
+    entries.add(entry);
+    if (!defaultEntry || entry->isDefault) defaultEntry = entry;
+  }
+
+  // Adds every *.json description in the directory, and returns the number added.
+  int addFromDirectory(const juce::File &directory, const PluginSettings &defaults,
+                       CreatePluginInstanceFunction createFunction) {
+    juce::Array<juce::File> files;
+    directory.findChildFiles(files, juce::File::findFiles, false, "*.json");
+    files.sort();
+    int numAdded = 0;
+    for (int i = 0; i < files.size(); ++i) {
+      juce::var config = juce::JSON::parse(files.getReference(i));
+      if (config["path"].toString().isEmpty()) {
+        juce::Logger::writeToLog("Ignoring plugin description without a path: " + files.getReference(i).getFullPathName());
+        continue;
+      }
+      add(new PluginEntry(config, files.getReference(i).getFileNameWithoutExtension(), defaults, createFunction));
+      ++numAdded;
+    }
+    return numAdded;
+  }
+
+  // Plugin paths are relative to this directory.
+  void setBaseDirectory(const juce::File &directory) {
+    const juce::ScopedLock sl(lock);
+    baseDirectory = directory;
+  }
+
+  void setMemoryBudgetMB(int budget) {
+    const juce::ScopedLock sl(lock);
+    memoryBudgetMB = budget;
+  }
+
+  // Loads every entry marked "preload", and returns false if any of them fails.
+  bool preload() {
+    juce::Array<PluginEntry *> toLoad;
+    {
+      const juce::ScopedLock sl(lock);
+      for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->preload) toLoad.add(entries[i]);
+      }
+    }
+    for (int i = 0; i < toLoad.size(); ++i) {
+      PluginEntry *entry = acquire(toLoad[i]->name);
+      if (!entry) return false;
+      release(entry);
+    }
+    return true;
+  }
+
+  // Returns the named entry (or the default one for an empty name), loaded and marked as in use,
+  // or nullptr if it is unknown or fails to load. The caller must release() it.
+  PluginEntry *acquire(const juce::String &name) {
+    PluginEntry *entry = nullptr;
+    {
+      const juce::ScopedLock sl(lock);
+      entry = name.isEmpty() ? defaultEntry : find(name);
+      if (!entry) return nullptr;
+      ++entry->activeRequests;
+      entry->lastUsed = juce::Time::getMillisecondCounter();
+    }
+
+    {
+      // While this request is active the entry cannot be unloaded, so only concurrent loads need excluding.
+      const juce::ScopedLock loadLock(entry->loadLock);
+      if (!isLoaded(entry) && !load(entry)) {
+        release(entry);
+        return nullptr;
+      }
+    }
+
+    evictOverBudget(entry);
+    return entry;
+  }
+
+  // Identifies the plugin that a request with this name would use: the entry's name and the fingerprint
+  // of its file when it was last loaded. Empty if the name is unknown.
+  juce::String getVersion(const juce::String &name) {
+    PluginEntry *entry = nullptr;
+    juce::File file;
+    {
+      const juce::ScopedLock sl(lock);
+      entry = name.isEmpty() ? defaultEntry : find(name);
+      if (!entry) return juce::String::empty;
+      if (entry->fingerprint.isNotEmpty()) return entry->name + "@" + entry->fingerprint;
+      file = baseDirectory.getChildFile(entry->path);
+    }
+
+    // Fingerprinting walks the whole bundle, so do it outside the lock. A load meanwhile takes its own,
+    // which is kept, since instances may already be reading it.
+    juce::String fingerprint = PluginFileFingerprint(file).toString();
+    const juce::ScopedLock sl(lock);
+    if (entry->fingerprint.isEmpty()) entry->fingerprint = fingerprint;
+    return entry->name + "@" + entry->fingerprint;
+  }
+
+  void release(PluginEntry *entry) {
+    {
+      const juce::ScopedLock sl(lock);
+      --entry->activeRequests;
+      entry->lastUsed = juce::Time::getMillisecondCounter();
+    }
+    // A pool that grew while serving requests may have taken the plugins over budget.
+    if (entry->grown.compareAndSetBool(0, 1)) evictOverBudget(nullptr);
+  }
+
+  void unloadAll() {
+    juce::OwnedArray<Unloaded> unloaded; // deleted after the lock is released
+    {
+      const juce::ScopedLock sl(lock);
+      for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i]->loaded) unloaded.add(detach(entries[i]));
+      }
+    }
+  }
+
+private:
+  // An unloaded entry's instances, deleted outside the lock since plugin teardown can be slow.
+  struct Unloaded {
+    juce::ScopedPointer<juce::AudioPluginInstance> residentInstance;
+    juce::ScopedPointer<PluginPool> pool;
+    juce::ScopedPointer<PrewarmedInstances> prewarmed;
+
+    ~Unloaded() {
+      // The resident instance goes last, so the plugin's code stays loaded until the others are gone.
+      prewarmed = nullptr;
+      pool = nullptr;
+      residentInstance = nullptr;
+    }
+  };
+
+  PluginEntry *find(const juce::String &name) const {
+    for (int i = 0; i < entries.size(); ++i) {
+      if (entries[i]->name.equalsIgnoreCase(name)) return entries[i];
+    }
+    return nullptr;
+  }
+
+  bool isLoaded(PluginEntry *entry) const {
+    const juce::ScopedLock sl(lock);
+    return entry->loaded;
+  }
+
+  // Creates the entry's instances without holding the registry lock, then installs them.
+  bool load(PluginEntry *entry) {
+    juce::Logger::writeToLog("Loading plugin " + entry->name + " from " + entry->path);
+    const PluginSettings &settings = entry->settings;
+
+    // The file may have changed since it was last loaded. Fingerprint it once here, rather than on
+    // every instance creation; instances of this load all describe the plugin with it.
+    juce::File file;
+    {
+      const juce::ScopedLock sl(lock);
+      file = baseDirectory.getChildFile(entry->path);
+    }
+    juce::String fingerprint = PluginFileFingerprint(file).toString();
+    {
+      const juce::ScopedLock sl(lock);
+      entry->fingerprint = fingerprint;
+    }
+
+    juce::ScopedPointer<juce::AudioPluginInstance> resident(entry->createInstance());
+    if (!resident) return false;
+    juce::ScopedPointer<ParameterIndex> parameterIndex(new ParameterIndex(resident));
+    int numChannels = juce::jmax(resident->getNumInputChannels(), resident->getNumOutputChannels());
+
+    juce::ScopedPointer<PluginPool> pool;
+    juce::ScopedPointer<PrewarmedInstances> prewarmed;
+    if (settings.poolLimits.maxSize > 0) {
+      pool = new PluginPool();
+      if (settings.poolLimits.minSize > 0) pool->add(new ThreadSafePlugin(resident.release()));
+      for (int i = 1; i < settings.poolLimits.minSize; ++i) {
+        juce::AudioPluginInstance *instance = entry->createInstance();
+        if (!instance) return false;
+        pool->add(new ThreadSafePlugin(instance));
+      }
+      pool->startAutoscaling(settings.poolLimits, entry);
+    }
+    else if (settings.prewarmCount > 0) {
+      prewarmed = new PrewarmedInstances();
+      prewarmed->start(settings.prewarmCount, entry);
+    }
+
+    const juce::ScopedLock sl(lock);
+    entry->residentInstance = resident.release();
+    entry->pool = pool.release();
+    entry->prewarmed = prewarmed.release();
+    entry->parameterIndex = parameterIndex.release();
+    entry->numChannels = numChannels;
+    entry->loaded = true;
+    return true;
+  }
+
+  // Must be called under the lock, with no active requests on the entry.
+  Unloaded *detach(PluginEntry *entry) {
+    jassert(entry->activeRequests == 0);
+    Unloaded *unloaded = new Unloaded();
+    unloaded->residentInstance = entry->residentInstance.release();
+    unloaded->pool = entry->pool.release();
+    unloaded->prewarmed = entry->prewarmed.release();
+    entry->loaded = false;
+    return unloaded;
+  }
+
+  void evictOverBudget(PluginEntry *keep) {
+    juce::OwnedArray<Unloaded> unloaded; // deleted after the lock is released
+    const juce::ScopedLock sl(lock);
+    if (memoryBudgetMB <= 0) return;
+
+    int totalMB = 0;
+    for (int i = 0; i < entries.size(); ++i) totalMB += entries[i]->getFootprintMB();
+
+    while (totalMB > memoryBudgetMB) {
+      PluginEntry *victim = nullptr;
+      for (int i = 0; i < entries.size(); ++i) {
+        PluginEntry *entry = entries[i];
+        if (entry == keep || !entry->loaded || entry->activeRequests > 0) continue;
+        if (!victim || (juce::int32)(entry->lastUsed - victim->lastUsed) < 0) victim = entry;
+      }
+      if (!victim) break;
+
+      juce::Logger::writeToLog("Unloading least recently used plugin " + victim->name);
+      totalMB -= victim->getFootprintMB();
+      unloaded.add(detach(victim));
+    }
+  }
+
+  juce::CriticalSection lock;
+  juce::OwnedArray<PluginEntry> entries;
+  int memoryBudgetMB; // 0 for unlimited
+  PluginEntry *defaultEntry;
+  juce::File baseDirectory;
+
+  JUCE_DECLARE_NON_COPYABLE(PluginRegistry)
+};
+
+// Releases an acquired registry entry when leaving scope.
+class ScopedPluginEntry {
+public:
+  ScopedPluginEntry(PluginRegistry &_registry, PluginEntry *_entry) : registry(_registry), entry(_entry) {}
+  ~ScopedPluginEntry() { if (entry) registry.release(entry); }
+
+  operator PluginEntry *() const { return entry; }
+  PluginEntry *operator->() const { return entry; }
+
+private:
+  PluginRegistry &registry;
+  PluginEntry *entry;
+
+  JUCE_DECLARE_NON_COPYABLE(ScopedPluginEntry)
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __PREWARMEDINSTANCES_HEADER__
+#define __PREWARMEDINSTANCES_HEADER__
+
+#include "JuceHeader.h"
+#include "PluginPool.h"
+
+// Keeps a bounded stock of freshly created, already-prepared instances for requests that
+// need a clean instance each time, and deletes used instances on the same background thread,
+// so neither instantiation nor teardown happens on a request's critical path.
+class PrewarmedInstances : private juce::Thread {
+public:
+  PrewarmedInstances() : juce::Thread("instance prewarmer"), factory(nullptr), stockSize(0) {}
+
+  ~PrewarmedInstances() {
+    stop();
+  }
+
+  void start(int _stockSize, PluginInstanceFactory *_factory) {
+    stockSize = _stockSize;
+    factory = _factory;
+    startThread();
+  }
+
+  // Stops the producer and deletes the stock along with any instances awaiting deletion.
+  void stop() {
+    stopThread(10000);
+    const juce::ScopedLock sl(lock);
+    ready.clear();
+    retired.clear();
+  }
+
+  // Returns a ready instance owned by the caller, or nullptr if the stock is empty.
+  juce::AudioPluginInstance *take() {
+    juce::AudioPluginInstance *instance = nullptr;
+    {
+      const juce::ScopedLock sl(lock);
+      instance = ready.removeAndReturn(0);
+    }
+    notify(); // replenish
+    return instance;
+  }
+
+  // Takes ownership of a used instance and deletes it in the background.
+  void retire(juce::AudioPluginInstance *instance) {
+    if (!instance) return;
+    {
+      const juce::ScopedLock sl(lock);
+      retired.add(instance);
+    }
+    notify();
+  }
+
+private:
+  void run() {
+    while (!threadShouldExit()) {
+      // Deleting first frees resources before more are allocated.
+      juce::ScopedPointer<juce::AudioPluginInstance> used;
+      bool needsStock;
+      {
+        const juce::ScopedLock sl(lock);
+        used = retired.removeAndReturn(0);
+        needsStock = ready.size() < stockSize;
+      }
+      if (used) {
+        used = nullptr;
+        continue;
+      }
+
+      if (needsStock && factory) {
+        juce::AudioPluginInstance *instance = factory->createInstance();
+        if (instance) {
+          const juce::ScopedLock sl(lock);
+          ready.add(instance);
+          continue;
+        }
+      }
+
+      wait(-1);
+    }
+  }
+
+  PluginInstanceFactory *factory;
+  int stockSize;
+  juce::CriticalSection lock;
+  juce::OwnedArray<juce::AudioPluginInstance> ready, retired;
+
+  JUCE_DECLARE_NON_COPYABLE(PrewarmedInstances)
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __RENDERCACHE_HEADER__
+#define __RENDERCACHE_HEADER__
+
+#include "JuceHeader.h"
+
+// Finished renders in memory, keyed by a hash of everything that determines their bytes. Once their
+// total size exceeds the budget, the least recently used are evicted first.
+class RenderCache {
+public:
+  // One cached render. Holders keep it alive while sending it, even if it is evicted meanwhile.
+  struct Render : public juce::ReferenceCountedObject {
+    typedef juce::ReferenceCountedObjectPtr<Render> Ptr;
+    juce::String key;
+    juce::MemoryBlock data;
+  };
+
+  RenderCache() : budgetBytes(0), totalBytes(0) {}
+
+  void setBudgetBytes(juce::int64 budget) {
+    const juce::ScopedLock sl(lock);
+    budgetBytes = budget;
+    evictOverBudget();
+  }
+
+  bool isEnabled() const {
+    return budgetBytes > 0;
+  }
+
+  // Returns the render with the given key, or nullptr.
+  Render::Ptr get(const juce::String &key) {
+    const juce::ScopedLock sl(lock);
+    for (int i = renders.size(); --i >= 0;) {
+      if (renders.getUnchecked(i)->key == key) {
+        Render::Ptr render = renders.getUnchecked(i);
+        renders.remove(i);
+        renders.add(render); // most recently used last
+        return render;
+      }
+    }
+    return nullptr;
+  }
+
+  void put(const juce::String &key, const void *data, size_t size) {
+    if ((juce::int64)size > budgetBytes) return;
+    Render::Ptr render = new Render();
+    render->key = key;
+    render->data.append(data, size);
+
+    const juce::ScopedLock sl(lock);
+    for (int i = 0; i < renders.size(); ++i) {
+      if (renders.getUnchecked(i)->key == key) {
+        totalBytes -= (juce::int64)renders.getUnchecked(i)->data.getSize();
+        renders.remove(i);
+        break;
+      }
+    }
+    renders.add(render);
+    totalBytes += (juce::int64)size;
+    evictOverBudget();
+  }
+
+  // A 128-bit hex digest of a description, from two independent 64-bit hashes.
+  static juce::String hashKey(const juce::String &description) {
+    return juce::String::toHexString(description.hashCode64()).paddedLeft('0', 16)
+      + juce::String::toHexString(hashData(description.toRawUTF8(), description.getNumBytesAsUTF8())).paddedLeft('0', 16);
+  }
+
+  // 64-bit FNV-1a.
+  static juce::int64 hashData(const void *data, size_t size) {
+    const juce::uint8 *bytes = static_cast<const juce::uint8 *>(data);
+    juce::uint64 hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return (juce::int64)hash;
+  }
+
+private:
+  // Must be called under the lock.
+  void evictOverBudget() {
+    while (totalBytes > budgetBytes && renders.size() > 0) {
+      totalBytes -= (juce::int64)renders.getUnchecked(0)->data.getSize();
+      renders.remove(0);
+    }
+  }
+
+  juce::CriticalSection lock;
+  juce::ReferenceCountedArray<Render> renders; // least recently used first
+  juce::int64 budgetBytes, totalBytes;
+
+  JUCE_DECLARE_NON_COPYABLE(RenderCache)
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __RENDERFILECACHE_HEADER__
+#define __RENDERFILECACHE_HEADER__
+
+#include "JuceHeader.h"
+
+// Finished renders on disk, one file per render key, so that they outlive the process and can be
+// shared by servers on the same host. Files are written under a temporary name and renamed into
+// place, so a reader never sees a partial render, and concurrent writers of the same key just
+// replace each other's identical bytes. Nothing is ever evicted; prune the directory externally.
+class RenderFileCache {
+public:
+  RenderFileCache() {}
+
+  // An empty path disables the cache.
+  void setDirectory(const juce::File &_directory) {
+    directory = _directory;
+    if (isEnabled() && !directory.createDirectory()) {
+      juce::Logger::writeToLog("Unable to create render cache directory " + directory.getFullPathName());
+      directory = juce::File::nonexistent;
+    }
+  }
+
+  bool isEnabled() const {
+    return directory != juce::File::nonexistent;
+  }
+
+  // Where the render with the given key is kept, spread over subdirectories by its first two digits.
+  juce::File getFile(const juce::String &key, const juce::String &extension) const {
+    return directory.getChildFile(key.substring(0, 2)).getChildFile(key + "." + extension);
+  }
+
+  // Returns the file of the render with the given key, or File::nonexistent if it is not cached.
+  juce::File get(const juce::String &key, const juce::String &extension) const {
+    if (!isEnabled()) return juce::File::nonexistent;
+    juce::File file = getFile(key, extension);
+    return file.existsAsFile() ? file : juce::File::nonexistent;
+  }
+
+  bool put(const juce::String &key, const juce::String &extension, const void *data, size_t size) {
+    if (!isEnabled()) return false;
+    juce::File file = getFile(key, extension);
+    if (!file.getParentDirectory().createDirectory()) return false;
+    juce::TemporaryFile temp(file);
+    if (!temp.getFile().replaceWithData(data, size) || !temp.overwriteTargetFileWithTemporary()) {
+      juce::Logger::writeToLog("Unable to write render cache file " + file.getFullPathName());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  juce::File directory;
+
+  JUCE_DECLARE_NON_COPYABLE(RenderFileCache)
+};
+
+#endif
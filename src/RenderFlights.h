@@ -0,0 +1,162 @@
+#ifndef __RENDERFLIGHTS_HEADER__
+#define __RENDERFLIGHTS_HEADER__
+
+#include "JuceHeader.h"
+
+// Renders in progress, by render key, so that identical requests arriving together cost one render.
+// The first request for a key leads the flight and renders; the rest join it, wait, and send the
+// leader's bytes once it finishes.
+class RenderFlights {
+public:
+  struct Flight : public juce::ReferenceCountedObject {
+    typedef juce::ReferenceCountedObjectPtr<Flight> Ptr;
+    juce::String key;
+    juce::WaitableEvent done; // signalled once, and stays signalled
+    int numFollowers; // guarded by the owner's lock
+    bool succeeded;
+    juce::MemoryBlock data; // only valid once done, and only if succeeded
+    bool joinable; // false once the leader streams without keeping a copy; guarded by the owner's lock
+
+    Flight() : done(true), numFollowers(0), succeeded(false), joinable(true) {}
+  };
+
+  // Leads a flight: publishes its result to the followers. A lead that goes out of scope without
+  // succeeding fails the flight, so followers never wait on a request that has given up.
+  class Lead {
+  public:
+    Lead(RenderFlights &_owner, Flight *_flight) : owner(_owner), flight(_flight) {}
+
+    ~Lead() {
+      if (flight) owner.finish(flight, false, nullptr, 0);
+    }
+
+    void succeed(const void *data, size_t size) {
+      if (flight) owner.finish(flight, true, data, size);
+      flight = nullptr;
+    }
+
+  private:
+    RenderFlights &owner;
+    Flight::Ptr flight;
+
+    JUCE_DECLARE_NON_COPYABLE(Lead)
+  };
+
+  // The stream a leader sends its response on, which also keeps a copy of the bytes for whoever needs
+  // them: a render cache, or followers. Whether to copy is settled at the first write. Without a cache
+  // or followers by then, nothing is copied, and the flight takes no more followers; identical requests
+  // arriving later render again. Should the client go away while followers wait, the render carries on
+  // into the copy for them.
+  class Capture : public juce::OutputStream {
+  public:
+    // The flight may be null. The expected size is reserved for the copy once it is known to be needed.
+    Capture(RenderFlights &_owner, Flight *_flight, juce::OutputStream &_client, size_t _expectedSize, bool _cached)
+      : owner(_owner), flight(_flight), client(_client), expectedSize(_expectedSize), cached(_cached),
+        decided(false), copying(false), clientFailed(false), position(0) {}
+
+    bool isCopying() const {
+      return copying;
+    }
+
+    const juce::MemoryOutputStream &getCopy() const {
+      return copy;
+    }
+
+    void flush() {
+      if (!clientFailed) client.flush();
+    }
+
+    bool write(const void *data, size_t size) {
+      if (!decided) {
+        decided = true;
+        copying = cached || (flight && owner.keepFollowing(flight));
+        if (copying) copy.preallocate(expectedSize);
+      }
+      if (!clientFailed && !client.write(data, size)) {
+        if (!copying || !flight || !owner.hasFollowers(flight)) return false;
+        clientFailed = true;
+      }
+      if (copying && !copy.write(data, size)) return false;
+      position += (juce::int64)size;
+      return true;
+    }
+
+    bool setPosition(juce::int64) {
+      return false;
+    }
+
+    juce::int64 getPosition() {
+      return position;
+    }
+
+  private:
+    RenderFlights &owner;
+    Flight::Ptr flight;
+    juce::OutputStream &client;
+    juce::MemoryOutputStream copy;
+    size_t expectedSize;
+    bool cached, decided, copying, clientFailed;
+    juce::int64 position;
+
+    JUCE_DECLARE_NON_COPYABLE(Capture)
+  };
+
+  RenderFlights() {}
+
+  // Returns the flight in progress for the key, or starts one with the caller leading it.
+  Flight::Ptr join(const juce::String &key, bool &isLeader) {
+    const juce::ScopedLock sl(lock);
+    for (int i = 0; i < flights.size(); ++i) {
+      if (flights.getUnchecked(i)->key == key && flights.getUnchecked(i)->joinable) {
+        isLeader = false;
+        flights.getUnchecked(i)->numFollowers++;
+        return flights.getUnchecked(i);
+      }
+    }
+    Flight::Ptr flight = new Flight();
+    flight->key = key;
+    flights.add(flight);
+    isLeader = true;
+    return flight;
+  }
+
+  // Stops following a flight, for a follower that has given up waiting on it.
+  void leave(Flight *flight) {
+    const juce::ScopedLock sl(lock);
+    flight->numFollowers--;
+  }
+
+private:
+  // Returns true if the flight has followers, and otherwise stops it taking any.
+  bool keepFollowing(Flight *flight) {
+    const juce::ScopedLock sl(lock);
+    if (flight->numFollowers == 0) flight->joinable = false;
+    return flight->joinable;
+  }
+
+  bool hasFollowers(Flight *flight) {
+    const juce::ScopedLock sl(lock);
+    return flight->numFollowers > 0;
+  }
+
+  void finish(Flight *flight, bool succeeded, const void *data, size_t size) {
+    bool hasFollowers;
+    {
+      const juce::ScopedLock sl(lock);
+      flights.removeObject(flight);
+      hasFollowers = flight->numFollowers > 0;
+    }
+    // Followers only read these after done is signalled, and new requests can no longer join.
+    // Without followers, nobody needs a copy of the bytes.
+    flight->succeeded = succeeded;
+    if (succeeded && hasFollowers) flight->data.append(data, size);
+    flight->done.signal();
+  }
+
+  juce::CriticalSection lock;
+  juce::ReferenceCountedArray<Flight> flights;
+
+  JUCE_DECLARE_NON_COPYABLE(RenderFlights)
+};
+
+#endif
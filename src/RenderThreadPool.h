@@ -0,0 +1,136 @@
+#ifndef __RENDERTHREADPOOL_HEADER__
+#define __RENDERTHREADPOOL_HEADER__
+
+#include "JuceHeader.h"
+
+// A fixed set of render threads, optionally pinned one per core. HTTP threads hand renders to them
+// and wait, so that each pooled instance can always be run on the same (home) thread, and its
+// DSP state stays in that core's caches instead of following whichever HTTP thread got the request.
+class RenderThreadPool {
+public:
+  struct Job {
+    virtual ~Job() {}
+    virtual void run() = 0;
+  };
+
+  RenderThreadPool() : nextHomeThread(0) {}
+
+  ~RenderThreadPool() {
+    stop();
+  }
+
+  // Starts the threads. When pinning, thread i only runs on core (i modulo the number of cores).
+  // Affinity masks are 32 bits wide, so threads whose core is beyond them are left unpinned.
+  void start(int numThreads, bool pinned) {
+    int numCpus = juce::jmax(1, juce::SystemStats::getNumCpus());
+    for (int i = 0; i < numThreads; ++i) {
+      int core = pinned ? (i % numCpus) : -1;
+      if (core >= 32) {
+        juce::Logger::writeToLog("Not pinning render thread " + juce::String(i) + " to core " + juce::String(core)
+                                 + ", which an affinity mask cannot express");
+        core = -1;
+      }
+      RenderThread *thread = new RenderThread(i, core);
+      threads.add(thread);
+      thread->startThread();
+    }
+  }
+
+  void stop() {
+    for (int i = 0; i < threads.size(); ++i) threads[i]->signalThreadShouldExit();
+    threads.clear(); // each thread is stopped by its destructor
+  }
+
+  bool isEnabled() const {
+    return threads.size() > 0;
+  }
+
+  // Picks a home thread for a new instance, spreading instances evenly across threads.
+  int assignHomeThread() {
+    return (int)(++nextHomeThread % (juce::uint32)threads.size());
+  }
+
+  // Runs the job on the given thread, or on the least busy one if threadIndex is negative,
+  // and returns once it has finished. Meanwhile the calling thread runs whileWaiting, if given,
+  // which must itself return once the job no longer needs it.
+  void runAndWait(Job &job, int threadIndex, Job *whileWaiting = nullptr) {
+    RenderThread *thread = threadIndex >= 0 ? threads[threadIndex % threads.size()] : getLeastBusyThread();
+    PendingJob pending(job);
+    thread->enqueue(&pending);
+    if (whileWaiting) whileWaiting->run();
+    pending.done.wait();
+  }
+
+private:
+  struct PendingJob {
+    Job &job;
+    juce::WaitableEvent done;
+    PendingJob(Job &_job) : job(_job) {}
+  };
+
+  class RenderThread : public juce::Thread {
+  public:
+    RenderThread(int index, int _core)
+      : juce::Thread("render " + juce::String(index)), core(_core), running(false) {}
+
+    ~RenderThread() {
+      stopThread(10000);
+    }
+
+    void enqueue(PendingJob *pending) {
+      {
+        const juce::ScopedLock sl(lock);
+        queue.add(pending);
+      }
+      notify();
+    }
+
+    int getNumQueued() const {
+      const juce::ScopedLock sl(lock);
+      return queue.size() + (running ? 1 : 0);
+    }
+
+    void run() {
+      if (core >= 0) setCurrentThreadAffinityMask(1u << core);
+      while (!threadShouldExit()) {
+        PendingJob *pending = nullptr;
+        {
+          const juce::ScopedLock sl(lock);
+          pending = queue.removeAndReturn(0);
+          running = pending != nullptr;
+        }
+        if (!pending) {
+          wait(-1);
+          continue;
+        }
+        pending->job.run();
+        {
+          const juce::ScopedLock sl(lock);
+          running = false;
+        }
+        pending->done.signal();
+      }
+    }
+
+  private:
+    int core; // -1 if not pinned
+    juce::CriticalSection lock;
+    juce::Array<PendingJob *> queue;
+    bool running;
+  };
+
+  RenderThread *getLeastBusyThread() const {
+    RenderThread *best = threads.getFirst();
+    for (int i = 1; i < threads.size(); ++i) {
+      if (threads[i]->getNumQueued() < best->getNumQueued()) best = threads[i];
+    }
+    return best;
+  }
+
+  juce::OwnedArray<RenderThread> threads;
+  juce::Atomic<juce::uint32> nextHomeThread;
+
+  JUCE_DECLARE_NON_COPYABLE(RenderThreadPool)
+};
+
+#endif
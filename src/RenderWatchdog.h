@@ -0,0 +1,142 @@
+#ifndef __RENDERWATCHDOG_HEADER__
+#define __RENDERWATCHDOG_HEADER__
+
+#include "JuceHeader.h"
+#include "PluginPool.h"
+
+// Times every processBlock() call of the renders in progress against a budget, so that a plugin
+// that spins or crawls cannot hold on to a pool instance indefinitely. A render whose block
+// overruns the budget is aborted, and its instance is quarantined and replaced by its pool.
+// Blocks that never return are caught by a background thread; slow ones when they return.
+class RenderWatchdog : private juce::Thread {
+public:
+  class Watch;
+
+  RenderWatchdog() : juce::Thread("render watchdog"), realtimeFactor(0), minBlockMillis(0) {}
+
+  ~RenderWatchdog() {
+    stop();
+  }
+
+  // Renders must process audio at least realtimeFactor times faster than realtime,
+  // with each block allowed at least minBlockMillis.
+  void start(double _realtimeFactor, int _minBlockMillis) {
+    realtimeFactor = _realtimeFactor;
+    minBlockMillis = _minBlockMillis;
+    startThread();
+  }
+
+  void stop() {
+    stopThread(1000);
+  }
+
+  bool isEnabled() const {
+    return realtimeFactor > 0;
+  }
+
+  // The longest a block of the given configuration may take, in milliseconds.
+  int getBlockBudgetMillis(const PluginConfiguration &config) const {
+    double blockMillis = 1000.0 * config.blockSize / config.sampleRate;
+    return juce::jmax(minBlockMillis, (int)(blockMillis / realtimeFactor));
+  }
+
+  // Watches one render. Call beginBlock() and endBlock() around each processBlock() call,
+  // and abort the render when endBlock() returns false.
+  class Watch {
+  public:
+    Watch(RenderWatchdog &_watchdog, ThreadSafePlugin *_plugin, const PluginConfiguration &config)
+      : watchdog(_watchdog), plugin(_plugin), budgetMillis(0) {
+      if (watchdog.isEnabled()) {
+        budgetMillis = watchdog.getBlockBudgetMillis(config);
+        watchdog.add(this);
+      }
+    }
+
+    ~Watch() {
+      if (budgetMillis > 0) watchdog.remove(this);
+    }
+
+    void beginBlock() {
+      blockStarted = (int)juce::Time::getMillisecondCounter();
+      inBlock = 1;
+    }
+
+    // Returns false if the block overran its budget, in which case the instance has been quarantined.
+    bool endBlock() {
+      inBlock = 0;
+      if (budgetMillis > 0 && (int)juce::Time::getMillisecondCounter() - blockStarted.get() > budgetMillis) {
+        abort();
+      }
+      return aborted.get() == 0;
+    }
+
+    bool isAborted() const {
+      return aborted.get() != 0;
+    }
+
+    int getBudgetMillis() const {
+      return budgetMillis;
+    }
+
+  private:
+    friend class RenderWatchdog;
+
+    bool isOverdue(juce::uint32 now) const {
+      return inBlock.get() != 0 && (int)now - blockStarted.get() > budgetMillis;
+    }
+
+    // Quarantines the instance, at most once per render.
+    void abort() {
+      if (aborted.compareAndSetBool(1, 0) && plugin->owner) {
+        plugin->owner->quarantine(plugin);
+      }
+    }
+
+    RenderWatchdog &watchdog;
+    ThreadSafePlugin *plugin;
+    int budgetMillis;
+    juce::Atomic<int> blockStarted, inBlock, aborted;
+
+    JUCE_DECLARE_NON_COPYABLE(Watch)
+  };
+
+private:
+  enum { CHECK_INTERVAL_MS = 20 };
+
+  void add(Watch *watch) {
+    const juce::ScopedLock sl(lock);
+    watches.add(watch);
+  }
+
+  void remove(Watch *watch) {
+    const juce::ScopedLock sl(lock);
+    watches.removeFirstMatchingValue(watch);
+  }
+
+  void run() {
+    while (!threadShouldExit()) {
+      {
+        const juce::ScopedLock sl(lock);
+        juce::uint32 now = juce::Time::getMillisecondCounter();
+        for (int i = 0; i < watches.size(); ++i) {
+          Watch *watch = watches.getUnchecked(i);
+          if (!watch->isAborted() && watch->isOverdue(now)) {
+            juce::Logger::writeToLog("Render has been stuck in a block for over "
+                                     + juce::String(watch->budgetMillis) + "ms");
+            watch->abort();
+          }
+        }
+      }
+      wait(CHECK_INTERVAL_MS);
+    }
+  }
+
+  double realtimeFactor; // 0 when disabled
+  int minBlockMillis;
+  juce::CriticalSection lock;
+  juce::Array<Watch *> watches;
+
+  JUCE_DECLARE_NON_COPYABLE(RenderWatchdog)
+};
+
+#endif
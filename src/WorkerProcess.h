@@ -0,0 +1,446 @@
+#ifndef __WORKERPROCESS_HEADER__
+#define __WORKERPROCESS_HEADER__
+
+#include "JuceHeader.h"
+#include "AudioBlockSink.h"
+#include "PluginPool.h"
+
+// A single-producer, single-consumer ring of planar float audio in a memory-mapped file,
+// shared between a worker process (which writes rendered blocks) and the server (which reads them).
+// The positions are running frame counts in the mapped header, updated with atomic operations.
+class SharedAudioRing {
+public:
+  enum { MAGIC = 0x4a424152 /* JBAR */ };
+
+  // Creates a zeroed ring file of the given capacity. Called by the server before starting a worker.
+  static bool createFile(const juce::File &file, int capacityFrames, int maxChannels) {
+    juce::int64 size = sizeof(Header) + (juce::int64)capacityFrames * maxChannels * sizeof(float);
+    juce::MemoryBlock zeros((size_t)size, true);
+    Header *header = static_cast<Header *>(zeros.getData());
+    header->magic = MAGIC;
+    header->capacityFrames = capacityFrames;
+    header->maxChannels = maxChannels;
+    return file.replaceWithData(zeros.getData(), zeros.getSize());
+  }
+
+  SharedAudioRing(const juce::File &file)
+    : mapped(file, juce::MemoryMappedFile::readWrite), header(nullptr), data(nullptr) {
+    if (mapped.getData() && mapped.getSize() >= sizeof(Header)) {
+      header = static_cast<Header *>(mapped.getData());
+      data = reinterpret_cast<float *>(header + 1);
+      if (header->magic != MAGIC) header = nullptr;
+    }
+  }
+
+  bool isValid() const {
+    return header != nullptr;
+  }
+
+  int getMaxChannels() const {
+    return header->maxChannels;
+  }
+
+  // Empties the ring before a job. Only called while the worker is idle.
+  void reset() {
+    header->written.set(0);
+    header->read.set(0);
+  }
+
+  // Appends the first numSamples of each channel, waiting for the reader to make room.
+  // Returns false if no room appeared before the deadline.
+  bool write(const juce::AudioSampleBuffer &buffer, int numSamples, juce::uint32 deadline) {
+    const int capacity = header->capacityFrames;
+    const int numChannels = juce::jmin(buffer.getNumChannels(), (int)header->maxChannels);
+    int done = 0;
+    while (done < numSamples) {
+      int written = header->written.get();
+      int space = capacity - (written - header->read.get());
+      if (space <= 0) {
+        if (millisecondsUntil(deadline) <= 0) return false;
+        juce::Thread::sleep(1);
+        continue;
+      }
+
+      int num = juce::jmin(space, numSamples - done);
+      int pos = written % capacity;
+      int first = juce::jmin(num, capacity - pos);
+      for (int ch = 0; ch < numChannels; ++ch) {
+        float *channelData = data + (size_t)ch * capacity;
+        const float *src = buffer.getSampleData(ch, done);
+        memcpy(channelData + pos, src, first * sizeof(float));
+        memcpy(channelData, src + first, (num - first) * sizeof(float));
+      }
+      header->written += num;
+      done += num;
+    }
+    return true;
+  }
+
+  // Copies up to maxSamples frames into the start of the buffer, and returns how many were copied.
+  int read(juce::AudioSampleBuffer &buffer, int maxSamples) {
+    const int capacity = header->capacityFrames;
+    const int numChannels = juce::jmin(buffer.getNumChannels(), (int)header->maxChannels);
+    int read = header->read.get();
+    int num = juce::jmin(maxSamples, header->written.get() - read);
+    if (num <= 0) return 0;
+
+    int pos = read % capacity;
+    int first = juce::jmin(num, capacity - pos);
+    for (int ch = 0; ch < numChannels; ++ch) {
+      const float *channelData = data + (size_t)ch * capacity;
+      float *dest = buffer.getSampleData(ch, 0);
+      memcpy(dest, channelData + pos, first * sizeof(float));
+      memcpy(dest + first, channelData, (num - first) * sizeof(float));
+    }
+    header->read += num;
+    return num;
+  }
+
+private:
+  struct Header {
+    juce::uint32 magic;
+    juce::int32 capacityFrames, maxChannels;
+    juce::Atomic<juce::int32> written, read; // frames since the last reset()
+  };
+
+  juce::MemoryMappedFile mapped;
+  Header *header;
+  float *data;
+
+  JUCE_DECLARE_NON_COPYABLE(SharedAudioRing)
+};
+
+// Messages between the server and its workers are small JSON objects; audio only goes through the ring.
+inline juce::MemoryBlock encodeWorkerMessage(const juce::var &message) {
+  juce::String text = juce::JSON::toString(message, true);
+  return juce::MemoryBlock(text.toRawUTF8(), text.getNumBytesAsUTF8());
+}
+
+inline juce::var decodeWorkerMessage(const juce::MemoryBlock &block) {
+  return juce::JSON::parse(juce::String::fromUTF8(static_cast<const char *>(block.getData()), (int)block.getSize()));
+}
+
+inline juce::var createWorkerMessage(const char *type) {
+  juce::DynamicObject *message = new juce::DynamicObject(); // freed with the returned var
+  message->setProperty("type", type);
+  return juce::var(message);
+}
+
+// The worker side: renders the jobs it receives in this (child) process, writing audio into the ring.
+// Handles a request the same way the server would in-process: listings go to the stream,
+// and rendered blocks to the sink.
+typedef bool (*WorkerRequestHandler)(const juce::var &request, bool listParameters,
+                                     juce::OutputStream &ostream, AudioBlockSink *sink);
+
+class WorkerClient : public juce::InterProcessConnection {
+public:
+  WorkerClient(const juce::File &ringFile, WorkerRequestHandler _handler)
+    : juce::InterProcessConnection(false /* callbacks on the connection thread */),
+      ring(ringFile), handler(_handler), finished(true) {}
+
+  ~WorkerClient() {
+    disconnect();
+  }
+
+  // Serves jobs until the server goes away. Returns a process exit code.
+  int run(const juce::String &pipeName) {
+    if (!ring.isValid() || !connectToPipe(pipeName, -1)) {
+      juce::Logger::writeToLog("Worker could not connect to " + pipeName);
+      return 1;
+    }
+    finished.wait();
+    return 0;
+  }
+
+  void connectionMade() {}
+
+  void connectionLost() {
+    finished.signal();
+  }
+
+  void messageReceived(const juce::MemoryBlock &block) {
+    juce::var job = decodeWorkerMessage(block);
+    if (job["type"].toString() != "render") return;
+
+    bool listParameters = job["listParameters"];
+    juce::MemoryBlock listing;
+    juce::MemoryOutputStream ostream(listing, false);
+    RingSink sink(*this);
+    bool ok = handler(job["request"], listParameters, ostream, listParameters ? nullptr : &sink);
+
+    juce::var done = createWorkerMessage("done");
+    done.getDynamicObject()->setProperty("ok", ok);
+    if (listParameters) done.getDynamicObject()->setProperty("listing", ostream.toUTF8());
+    sendMessage(encodeWorkerMessage(done));
+  }
+
+private:
+  enum { RING_WAIT_MS = 10000 };
+
+  // Writes blocks to the ring, and rings the server's doorbell after each one.
+  struct RingSink : public AudioBlockSink {
+    WorkerClient &client;
+    RingSink(WorkerClient &_client) : client(_client) {}
+
+    bool writeBlock(const juce::AudioSampleBuffer &buffer, int numSamples) {
+      if (!client.ring.write(buffer, numSamples, juce::Time::getMillisecondCounter() + RING_WAIT_MS)) return false;
+      return client.sendMessage(encodeWorkerMessage(createWorkerMessage("block")));
+    }
+  };
+
+  SharedAudioRing ring;
+  WorkerRequestHandler handler;
+  juce::WaitableEvent finished;
+
+  JUCE_DECLARE_NON_COPYABLE(WorkerClient)
+};
+
+// The server side of one worker process: starts it, sends it jobs, and collects the results.
+// A worker that crashes or stops responding fails only the job it was running, and is restarted
+// before its next job.
+class WorkerHost : public juce::InterProcessConnection {
+public:
+  WorkerHost(const juce::StringArray &_arguments, int _ringFrames, int _maxChannels)
+    : juce::InterProcessConnection(false /* callbacks on the connection thread */),
+      arguments(_arguments), ringFrames(_ringFrames), maxChannels(_maxChannels), alive(false),
+      finished(false), succeeded(false) {}
+
+  ~WorkerHost() {
+    stop();
+  }
+
+  bool start() {
+    stop();
+    juce::String id = juce::String::toHexString(juce::Random::getSystemRandom().nextInt64());
+    pipeName = "jucebouncer_worker_" + id;
+    ringFile = juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile(pipeName + ".ring");
+    if (!SharedAudioRing::createFile(ringFile, ringFrames, maxChannels)) return false;
+    ring = new SharedAudioRing(ringFile);
+    if (!ring->isValid() || !createPipe(pipeName, -1)) return false;
+
+    // The worker is this same executable, given the server's arguments plus its own.
+    juce::StringArray command(arguments);
+    command.insert(0, juce::File::getSpecialLocation(juce::File::currentExecutableFile).getFullPathName());
+    command.add("--workerPipe");
+    command.add(pipeName);
+    command.add("--workerRing");
+    command.add(ringFile.getFullPathName());
+    // Its output is not captured, since nothing would drain the pipe and a full pipe would block it.
+    if (!process.start(command, 0)) return false;
+
+    alive = true;
+    juce::Logger::writeToLog("Started worker " + pipeName);
+    return true;
+  }
+
+  void stop() {
+    alive = false;
+    disconnect();
+    if (process.isRunning()) process.kill();
+    ring = nullptr;
+    if (ringFile.exists()) ringFile.deleteFile();
+  }
+
+  bool isAlive() {
+    return alive && process.isRunning();
+  }
+
+  // Runs one job on the worker: a listing is written to the stream, and audio is read from
+  // the ring and passed to the sink as it arrives. A worker that misses the deadline is stopped.
+  bool render(const juce::var &request, bool listParameters, const PluginConfiguration &config,
+              juce::uint32 deadline, juce::OutputStream &ostream, AudioBlockSink *sink) {
+    if (config.nChannels > maxChannels) return false;
+    ring->reset();
+    {
+      const juce::ScopedLock sl(resultLock);
+      finished = false;
+      succeeded = false;
+      listing = juce::String::empty;
+    }
+
+    juce::var job = createWorkerMessage("render");
+    job.getDynamicObject()->setProperty("request", request);
+    job.getDynamicObject()->setProperty("listParameters", listParameters);
+    if (!sendMessage(encodeWorkerMessage(job))) {
+      stop();
+      return false;
+    }
+
+    juce::AudioSampleBuffer buffer(juce::jmax(1, config.nChannels), juce::jmax(1, config.blockSize));
+    for (;;) {
+      int remaining = millisecondsUntil(deadline);
+      if (remaining > 0) progress.wait(remaining);
+
+      bool isFinished;
+      {
+        const juce::ScopedLock sl(resultLock);
+        isFinished = finished;
+      }
+      // Finishing is only announced after the last block is written, so draining afterwards gets everything.
+      if (sink) {
+        int num;
+        while ((num = ring->read(buffer, buffer.getNumSamples())) > 0) {
+          if (!sink->writeBlock(buffer, num)) return abandon();
+        }
+      }
+
+      if (isFinished) break;
+      if (!isAlive()) {
+        juce::Logger::writeToLog("Worker " + pipeName + " died during a job");
+        return abandon();
+      }
+      if (millisecondsUntil(deadline) <= 0) {
+        juce::Logger::writeToLog("Worker " + pipeName + " missed its deadline");
+        return abandon();
+      }
+    }
+
+    const juce::ScopedLock sl(resultLock);
+    if (listParameters && succeeded) ostream << listing;
+    return succeeded;
+  }
+
+  void connectionMade() {}
+
+  void connectionLost() {
+    alive = false;
+    progress.signal();
+  }
+
+  void messageReceived(const juce::MemoryBlock &block) {
+    juce::var message = decodeWorkerMessage(block);
+    if (message["type"].toString() == "done") {
+      const juce::ScopedLock sl(resultLock);
+      finished = true;
+      succeeded = message["ok"];
+      listing = message["listing"].toString();
+    }
+    progress.signal();
+  }
+
+private:
+  // A worker in an unknown state can't be given another job, so it is restarted on next use.
+  bool abandon() {
+    stop();
+    return false;
+  }
+
+  juce::StringArray arguments;
+  int ringFrames, maxChannels;
+  juce::String pipeName;
+  juce::File ringFile;
+  juce::ScopedPointer<SharedAudioRing> ring;
+  juce::ChildProcess process;
+  bool alive;
+
+  juce::WaitableEvent progress;
+  juce::CriticalSection resultLock;
+  bool finished, succeeded;
+  juce::String listing;
+
+  JUCE_DECLARE_NON_COPYABLE(WorkerHost)
+};
+
+// A fixed set of worker processes, each running one job at a time.
+class WorkerPool {
+public:
+  WorkerPool() : jobTimeoutMillis(0) {}
+
+  ~WorkerPool() {
+    stop();
+  }
+
+  // Starts the workers, passing each one the server's own arguments.
+  // Each job is given jobTimeoutMillis to finish once it has a worker.
+  bool start(int numWorkers, const juce::StringArray &arguments, int ringFrames, int maxChannels, int _jobTimeoutMillis) {
+    jobTimeoutMillis = _jobTimeoutMillis;
+    for (int i = 0; i < numWorkers; ++i) {
+      WorkerHost *worker = new WorkerHost(arguments, ringFrames, maxChannels);
+      workers.add(worker);
+      if (!worker->start()) return false;
+      idle.add(worker);
+    }
+    return true;
+  }
+
+  void stop() {
+    const juce::ScopedLock sl(lock);
+    idle.clear();
+    workers.clear();
+  }
+
+  bool isEnabled() const {
+    return workers.size() > 0;
+  }
+
+  // Runs a request on the first worker to become free before the deadline.
+  bool handle(const juce::var &request, bool listParameters, const PluginConfiguration &config,
+              juce::uint32 deadline, juce::OutputStream &ostream, AudioBlockSink *sink) {
+    WorkerHost *worker = acquire(deadline);
+    if (!worker) {
+      juce::Logger::writeToLog("Timed out waiting for a worker");
+      return false;
+    }
+    juce::uint32 jobDeadline = juce::Time::getMillisecondCounter() + jobTimeoutMillis;
+    bool result = (worker->isAlive() || worker->start())
+                  && worker->render(request, listParameters, config, jobDeadline, ostream, sink);
+    release(worker);
+    return result;
+  }
+
+private:
+  // A request waiting for a worker, which release() hands one to directly, as in PluginPool.
+  struct Waiter {
+    juce::WaitableEvent event;
+    WorkerHost *granted;
+
+    Waiter() : granted(nullptr) {}
+  };
+
+  // Waits in line for a worker, oldest request first, until the deadline.
+  WorkerHost *acquire(juce::uint32 deadline) {
+    Waiter waiter;
+    {
+      const juce::ScopedLock sl(lock);
+      if (waiters.size() == 0 && idle.size() > 0) return idle.removeAndReturn(0);
+      waiters.add(&waiter);
+    }
+
+    for (;;) {
+      int remaining = millisecondsUntil(deadline);
+      if (remaining > 0) waiter.event.wait(remaining);
+
+      // The grant and the timeout are both decided under the lock,
+      // so a worker released at the last moment is never lost.
+      const juce::ScopedLock sl(lock);
+      if (waiter.granted) return waiter.granted;
+      if (millisecondsUntil(deadline) <= 0) {
+        waiters.removeFirstMatchingValue(&waiter);
+        return nullptr;
+      }
+    }
+  }
+
+  // Hands the worker straight to the oldest waiting request, if there is one.
+  void release(WorkerHost *worker) {
+    const juce::ScopedLock sl(lock);
+    if (waiters.size() > 0) {
+      Waiter *waiter = waiters.removeAndReturn(0);
+      waiter->granted = worker;
+      waiter->event.signal();
+    }
+    else {
+      idle.add(worker);
+    }
+  }
+
+  int jobTimeoutMillis;
+  juce::CriticalSection lock;
+  juce::OwnedArray<WorkerHost> workers;
+  juce::Array<WorkerHost *> idle;
+  juce::Array<Waiter *> waiters; // oldest first
+
+  JUCE_DECLARE_NON_COPYABLE(WorkerPool)
+};
+
+#endif
@@ -2,11 +2,24 @@
 #include <iostream>
 #include "JuceHeader.h"
 #include "mongoose.h"
+#include "MongooseOutputStream.h"
+#include "HandoffOutputStream.h"
 #include "NonDeletingOutputStream.h"
+#include "AllocationCounter.h"
+#include "PluginDescriptionCache.h"
+#include "MidiSchedule.h"
+#include "ParameterAutomation.h"
+#include "ParameterListCache.h"
+#include "PluginRegistry.h"
+#include "RenderCache.h"
+#include "RenderFileCache.h"
+#include "RenderFlights.h"
+#include "RenderThreadPool.h"
+#include "RenderWatchdog.h"
+#include "WorkerProcess.h"
 #include "urlutils.h"
 
-#define PLUGIN_POOL_SIZE 0
-#define PLUGIN_REL_PATH "plugins/miniTERA.vst"
+#define PLUGIN_REL_PATH "plugins/miniTERA.vst" // used when no plugin descriptions are configured
 
 // #include <csignal>
 // #define EMBED_BREAKPOINT raise(SIGINT)
@@ -22,14 +35,16 @@ class DebugLogger : public Logger {
 };
 static DebugLogger DEBUG_LOGGER;
 
-struct ThreadSafePlugin {
-  CriticalSection crit;
-  ScopedPointer<AudioPluginInstance> instance;
-
-  ThreadSafePlugin(AudioPluginInstance *_instance) : instance(_instance) {}
-};
-
-static OwnedArray<ThreadSafePlugin, CriticalSection> pluginPool;
+static PluginRegistry pluginRegistry;
+static PluginDescriptionCache pluginDescriptionCache;
+static RenderWatchdog renderWatchdog;
+static WorkerPool workerPool;
+static RenderThreadPool renderThreads;
+static RenderCache renderCache;
+static RenderFileCache renderFileCache;
+static RenderFlights renderFlights;
+static ParameterListCache parameterListCache;
+static AudioFormatManager outputFormats; // registered once in main(), then only read
 static File cwd = File::getCurrentWorkingDirectory();
 
 String resolveRelativePath(String relativePath) {
@@ -38,45 +53,179 @@ String resolveRelativePath(String relativePath) {
   return cwd.getChildFile(relativePath).getFullPathName();
 }
 
-// The caller is responsible for deleting the object that is returned
-AudioPluginInstance *createSynthInstance() {
+// The caller is responsible for deleting the object that is returned.
+// Returns nullptr if the plugin could not be instantiated.
+AudioPluginInstance *createSynthInstance(const String &pluginPath, const String &fingerprint) {
   AudioPluginFormatManager pluginManager;
   pluginManager.addDefaultFormats();
 
   PluginDescription desc;
-  desc.fileOrIdentifier = resolveRelativePath(PLUGIN_REL_PATH);
-  // DBG << desc.fileOrIdentifier << endl;
-  desc.uid = 0;
+  String fullPath = resolveRelativePath(pluginPath);
+  if (!pluginDescriptionCache.getDescription(pluginManager, fullPath, desc, fingerprint)) {
+    // Let the formats have a go with a minimal description, as if the plugin had never been scanned.
+    desc.fileOrIdentifier = fullPath;
+    desc.uid = 0;
+  }
 
   String errorMessage;
   AudioPluginInstance *instance = pluginManager.createPluginInstance(desc, errorMessage);
   
   if (!instance) {
     DBG << "Error creating plugin instance: " << errorMessage << endl;
-    exit(1);
+    return nullptr;
   }
 
-  // Force initialization on the main thread. This preparation will redone with proper values later.
-  instance->prepareToPlay(44100, 512);
+  // Force initialization on the main thread. ThreadSafePlugin only prepares again for other configurations.
+  PluginConfiguration config = PluginConfiguration::initial();
+  instance->prepareToPlay(config.sampleRate, config.blockSize);
 
   return instance;
 }
 
+// Command-line options, given as "--name value" or "--name=value".
+struct ServerOptions {
+  int poolMin, poolMax; // a maximum of 0 creates a fresh instance for every request
+  int poolGrowQueueDepth, poolGrowWaitMillis, poolIdleMillis;
+  int prewarmCount; // fresh instances kept ready when there is no pool
+  bool poolRestoreState; // restore pooled instances to their creation state between requests
+  String pluginConfigDir; // a directory of *.json plugin descriptions
+  String pluginCacheFile; // where scanned plugin descriptions are persisted
+  int pluginMemoryMB, pluginMemoryBudgetMB; // estimated per-instance footprint, and the total (0 for unlimited)
+  double watchdogRealtimeFactor; // renders must run at least this much faster than realtime (0 to disable)
+  int watchdogMinBlockMillis; // but each block is allowed at least this long
+  int workerProcesses; // render in this many child processes instead of in-process (0 for none)
+  int workerRingFrames, workerMaxChannels; // shared-memory ring capacity per worker
+  int workerJobTimeoutMillis; // a worker that takes longer than this for a job is restarted
+  String workerPipe, workerRing; // set only in a worker process, by the server that started it
+  int httpThreads; // mongoose threads, which accept and parse requests
+  int renderThreads; // dedicated render threads (0 to render on the HTTP threads)
+  bool renderThreadsPinned; // pin render thread i to core i
+  int streamBufferKB; // streamed audio a render thread may get ahead of its client by
+  int batchMaxLanes; // instances (or workers) a batch may use at once, per plugin
+  String midiFileDir; // where requests' "midiFile" names are looked up
+  int previewSampleRate, previewChannels; // upper limits for previews
+  int renderCacheMB; // memory for finished renders, served again to identical requests (0 to disable)
+  String renderCacheDir; // where finished renders are also kept on disk (empty to disable)
+  float previewMaxSeconds;
+
+  // Leaves everything zeroed for the global below, which main() then assigns. Parsing here would run
+  // during static initialization, when JUCE's own statics such as var::null may not exist yet.
+  ServerOptions() {}
+
+  explicit ServerOptions(const var &options) {
+    #define SERVER_OPTIONS_DEFAULT(name, default) \
+      if (!options[#name].isVoid()) {name = options[#name];} else {name = default;}
+    SERVER_OPTIONS_DEFAULT(poolMin, 0)
+    SERVER_OPTIONS_DEFAULT(poolMax, 0)
+    SERVER_OPTIONS_DEFAULT(poolGrowQueueDepth, 2)
+    SERVER_OPTIONS_DEFAULT(poolGrowWaitMillis, 100)
+    SERVER_OPTIONS_DEFAULT(poolIdleMillis, 60000)
+    SERVER_OPTIONS_DEFAULT(prewarmCount, 2)
+    SERVER_OPTIONS_DEFAULT(poolRestoreState, true)
+    SERVER_OPTIONS_DEFAULT(pluginConfigDir, "config/plugins")
+    SERVER_OPTIONS_DEFAULT(pluginCacheFile, "cache/plugins.xml")
+    SERVER_OPTIONS_DEFAULT(pluginMemoryMB, 64)
+    SERVER_OPTIONS_DEFAULT(pluginMemoryBudgetMB, 0)
+    SERVER_OPTIONS_DEFAULT(watchdogRealtimeFactor, 0.0)
+    SERVER_OPTIONS_DEFAULT(watchdogMinBlockMillis, 100)
+    SERVER_OPTIONS_DEFAULT(workerProcesses, 0)
+    SERVER_OPTIONS_DEFAULT(workerRingFrames, 65536)
+    SERVER_OPTIONS_DEFAULT(workerMaxChannels, 8)
+    SERVER_OPTIONS_DEFAULT(workerJobTimeoutMillis, 60000)
+    SERVER_OPTIONS_DEFAULT(workerPipe, String::empty)
+    SERVER_OPTIONS_DEFAULT(workerRing, String::empty)
+    SERVER_OPTIONS_DEFAULT(httpThreads, 20)
+    SERVER_OPTIONS_DEFAULT(renderThreads, 0)
+    SERVER_OPTIONS_DEFAULT(renderThreadsPinned, true)
+    SERVER_OPTIONS_DEFAULT(streamBufferKB, 1024)
+    SERVER_OPTIONS_DEFAULT(batchMaxLanes, 4)
+    SERVER_OPTIONS_DEFAULT(midiFileDir, "midi")
+    SERVER_OPTIONS_DEFAULT(previewSampleRate, 22050)
+    SERVER_OPTIONS_DEFAULT(previewChannels, 1)
+    SERVER_OPTIONS_DEFAULT(previewMaxSeconds, 0.75f)
+    SERVER_OPTIONS_DEFAULT(renderCacheMB, 128)
+    SERVER_OPTIONS_DEFAULT(renderCacheDir, String::empty)
+
+    if (poolMax > 0 && poolMin > poolMax) poolMin = poolMax;
+  }
+
+  static var parseCommandLine(int argc, char *argv[]) {
+    DynamicObject *obj = new DynamicObject(); // freed when the returned var leaves scope
+    var result(obj);
+    for (int i = 1; i < argc; ++i) {
+      String arg(argv[i]);
+      if (!arg.startsWith("--")) continue;
+      String name = arg.substring(2).upToFirstOccurrenceOf("=", false, false);
+      String value;
+      if (arg.containsChar('=')) value = arg.fromFirstOccurrenceOf("=", false, false);
+      else if (i + 1 < argc) value = argv[++i];
+      // Numbers and booleans are parsed as JSON, anything else is kept as a string.
+      var parsed = JSON::parse(value);
+      obj->setProperty(name, parsed.isVoid() ? var(value) : parsed);
+    }
+    return result;
+  }
+
+  // The settings used by plugin descriptions that do not override them.
+  PluginSettings getPluginSettings() const {
+    PluginSettings settings;
+    settings.poolLimits.minSize = poolMin;
+    settings.poolLimits.maxSize = poolMax;
+    settings.poolLimits.growQueueDepth = poolGrowQueueDepth;
+    settings.poolLimits.growWaitMillis = poolGrowWaitMillis;
+    settings.poolLimits.idleMillis = poolIdleMillis;
+    settings.prewarmCount = prewarmCount;
+    settings.memoryMB = pluginMemoryMB;
+    return settings;
+  }
+};
+static ServerOptions serverOptions; // assigned at the start of main()
+
+// One note of a multi-note request, timed in seconds from the start of the render.
+struct NoteEvent {
+  float start, duration;
+  int pitch, velocity, channel;
+};
+
+// One effect of a request's chain, which processes the instrument's output in order.
+struct EffectParameters {
+  String plugin; // registry name
+  int presetNumber;
+  NamedValueSet parameters, indexedParameters;
+};
+
 struct PluginRequestParameters {
+  var request; // as parsed, for forwarding to worker processes
+  String plugin; // registry name; empty for the default plugin
   int presetNumber;
   bool listParameters;
+  bool preview; // a cheap render for interactive use: lower rate, fewer channels, shorter
   int sampleRate, blockSize, bitDepth;
   int nChannels;
   int midiChannel, midiPitch, midiVelocity;
   float noteSeconds, renderSeconds;
+  bool endOnSilence; // end once the tail stays below the threshold, with renderSeconds as a cap
+  float silenceThresholdDb, silenceHoldSeconds;
+  int timeoutMillis;
   String formatName, contentType;
   NamedValueSet parameters, indexedParameters;
+  NamedValueSet automation, indexedAutomation; // curves by parameter name or index
+  int automationStepSamples;
+  Array<NoteEvent> notes; // if empty, a single note from midiPitch, midiVelocity and noteSeconds
+  bool hasMidiFile; // if so, its events replace the notes
+  MidiMessageSequence midiFileEvents; // timestamped in seconds
+  String midiFileHash; // of the file's bytes
+  String midiFileError; // if the MIDI file could not be loaded
+  Array<EffectParameters> effects;
 
   PluginRequestParameters(const var &params = var::null) {
     #define PLUGIN_REQUEST_PARAMETERS_DEFAULT(name, default) \
       if (params[#name]) {name = params[#name];} else {name = default;}
+    request = params;
+    plugin = params["plugin"].toString();
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(presetNumber, -1)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(listParameters, false)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(preview, false)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(sampleRate, 44100)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(blockSize, 2056)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(bitDepth, 16)
@@ -86,6 +235,11 @@ struct PluginRequestParameters {
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(midiPitch, 60)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(midiVelocity, 120)
     PLUGIN_REQUEST_PARAMETERS_DEFAULT(noteSeconds, 0.75f)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(endOnSilence, false)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(silenceThresholdDb, -80.0f)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(silenceHoldSeconds, 0.2f)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(timeoutMillis, 5000)
+    PLUGIN_REQUEST_PARAMETERS_DEFAULT(automationStepSamples, 32)
 
     #define PLUGIN_REQUEST_PARAMETER_DICT(name) { \
       DynamicObject *paramDynObj = params[#name].getDynamicObject(); \
@@ -93,6 +247,198 @@ struct PluginRequestParameters {
 
     PLUGIN_REQUEST_PARAMETER_DICT(parameters)
     PLUGIN_REQUEST_PARAMETER_DICT(indexedParameters)
+    PLUGIN_REQUEST_PARAMETER_DICT(automation)
+    PLUGIN_REQUEST_PARAMETER_DICT(indexedAutomation)
+
+    // Each note's fields default to the single-note parameters above.
+    if (const Array<var> *notesArray = params["notes"].getArray()) {
+      for (int i = 0; i < notesArray->size(); ++i) {
+        const var &note = notesArray->getReference(i);
+        NoteEvent event;
+        #define NOTE_EVENT_DEFAULT(name, default) \
+          if (!note[#name].isVoid()) {event.name = note[#name];} else {event.name = default;}
+        NOTE_EVENT_DEFAULT(start, 0.0f)
+        NOTE_EVENT_DEFAULT(duration, noteSeconds)
+        NOTE_EVENT_DEFAULT(pitch, midiPitch)
+        NOTE_EVENT_DEFAULT(velocity, midiVelocity)
+        NOTE_EVENT_DEFAULT(channel, midiChannel)
+        notes.add(event);
+      }
+    }
+
+    // Each effect has its own plugin, presetNumber, parameters and indexedParameters.
+    if (const Array<var> *effectsArray = params["effects"].getArray()) {
+      for (int i = 0; i < effectsArray->size(); ++i) {
+        const var &effectVar = effectsArray->getReference(i);
+        EffectParameters effect;
+        effect.plugin = effectVar["plugin"].toString();
+        effect.presetNumber = effectVar["presetNumber"].isVoid() ? -1 : (int)effectVar["presetNumber"];
+        if (DynamicObject *obj = effectVar["parameters"].getDynamicObject()) effect.parameters = obj->getProperties();
+        if (DynamicObject *obj = effectVar["indexedParameters"].getDynamicObject()) effect.indexedParameters = obj->getProperties();
+        effects.add(effect);
+      }
+    }
+
+    if (preview) {
+      sampleRate = jmin(sampleRate, serverOptions.previewSampleRate);
+      nChannels = jmin(nChannels, serverOptions.previewChannels);
+      renderSeconds = jmin(renderSeconds, serverOptions.previewMaxSeconds);
+    }
+
+    // A MIDI file is given inline as base64 "midiData", or by name as "midiFile". Unless renderSeconds
+    // is given, the render then lasts until the file's last event plus the default renderSeconds.
+    String midiData = params["midiData"].toString(), midiFile = params["midiFile"].toString();
+    hasMidiFile = midiData.isNotEmpty() || midiFile.isNotEmpty();
+    if (hasMidiFile) {
+      midiFileError = loadMidiFile(midiData, midiFile);
+      if (midiFileError.isEmpty() && !params["renderSeconds"] && !preview) renderSeconds += (float)midiFileEvents.getEndTime();
+    }
+  }
+
+  // Reads every track of a standard MIDI file into midiFileEvents, and returns an error message on failure.
+  String loadMidiFile(const String &midiData, const String &midiFile) {
+    MemoryBlock block;
+    if (midiData.isNotEmpty()) {
+      if (!base64decode(midiData, block)) return "midiData is not valid base64";
+    }
+    else {
+      File dir(resolveRelativePath(serverOptions.midiFileDir));
+      File file = dir.getChildFile(midiFile);
+      if (!file.isAChildOf(dir)) return "midiFile is outside the MIDI file directory: " + midiFile;
+      if (!file.loadFileAsData(block)) return "Unable to read MIDI file: " + file.getFullPathName();
+    }
+
+    midiFileHash = String::toHexString(RenderCache::hashData(block.getData(), block.getSize()));
+    MidiFile parsed;
+    MemoryInputStream stream(block, false);
+    if (!parsed.readFrom(stream)) return "Not a standard MIDI file";
+    parsed.convertTimestampTicksToSeconds();
+    for (int i = 0; i < parsed.getNumTracks(); ++i) {
+      midiFileEvents.addSequence(*parsed.getTrack(i), 0.0, 0.0, 1.0e9);
+    }
+    return String::empty;
+  }
+
+  // Schedules every note-on and note-off at its sample position.
+  void scheduleMidi(MidiSchedule &schedule) const {
+    schedule.clear();
+    if (hasMidiFile) {
+      // Meta events (tempo, track names and so on) mean nothing to a plugin.
+      for (int i = 0; i < midiFileEvents.getNumEvents(); ++i) {
+        const MidiMessage &message = midiFileEvents.getEventPointer(i)->message;
+        if (!message.isMetaEvent()) schedule.addEvent(message, (int)(message.getTimeStamp() * sampleRate));
+      }
+      return;
+    }
+    if (notes.size() == 0) {
+      schedule.addEvent(MidiMessage::noteOn(midiChannel, (uint8)midiPitch, (uint8)midiVelocity), 0);
+      schedule.addEvent(MidiMessage::allNotesOff(midiChannel), (int)(noteSeconds * sampleRate));
+      return;
+    }
+    // Note-offs go in first, so that a note ending where the same pitch starts again is released before it restarts.
+    for (int i = 0; i < notes.size(); ++i) {
+      const NoteEvent &note = notes.getReference(i);
+      schedule.addEvent(MidiMessage::noteOff(note.channel, note.pitch), (int)((note.start + note.duration) * sampleRate));
+    }
+    for (int i = 0; i < notes.size(); ++i) {
+      const NoteEvent &note = notes.getReference(i);
+      schedule.addEvent(MidiMessage::noteOn(note.channel, note.pitch, (uint8)note.velocity), (int)(note.start * sampleRate));
+    }
+  }
+
+  // Schedules the automation curves of the instance's parameters, named then indexed.
+  // Like parameters, named curves go through the plugin's index if it has one.
+  void scheduleAutomation(AudioPluginInstance *instance, const ParameterIndex *index, ParameterAutomation &schedule) const {
+    schedule.clear();
+    schedule.setStepSamples(automationStepSamples);
+    int numParams = instance->getNumParameters();
+    if (!index) {
+      for (int i = 0; i < numParams; ++i) {
+        var curve = automation.getWithDefault(Identifier(instance->getParameterName(i)), var::null);
+        if (!curve.isVoid()) scheduleCurve(schedule, i, curve);
+      }
+    }
+    else {
+      for (int j = 0; j < automation.size(); ++j) {
+        for (int i = index->getFirstIndex(automation.getName(j).toString()); i >= 0; i = index->getNextIndex(i)) {
+          scheduleCurve(schedule, i, automation.getValueAt(j));
+        }
+      }
+    }
+    for (int j = 0; j < indexedAutomation.size(); ++j) {
+      int i = indexedAutomation.getName(j).toString().getIntValue();
+      if (i >= 0 && i < numParams) scheduleCurve(schedule, i, indexedAutomation.getValueAt(j));
+    }
+  }
+
+  // A curve is either breakpoints, as [[seconds, value], ...], or a ramp, as
+  // {"from": value, "to": value, "start": seconds, "end": seconds}. A ramp's start
+  // defaults to 0 and its end to renderSeconds.
+  void scheduleCurve(ParameterAutomation &schedule, int parameterIndex, const var &curve) const {
+    if (const Array<var> *points = curve.getArray()) {
+      for (int i = 0; i < points->size(); ++i) {
+        const var &point = points->getReference(i);
+        schedule.addBreakpoint(parameterIndex, (int)((float)point[0] * sampleRate), (float)point[1]);
+      }
+    }
+    else if (curve.getDynamicObject()) {
+      float start = curve["start"].isVoid() ? 0.0f : (float)curve["start"];
+      float end = curve["end"].isVoid() ? renderSeconds : (float)curve["end"];
+      schedule.addBreakpoint(parameterIndex, (int)(start * sampleRate), (float)curve["from"]);
+      schedule.addBreakpoint(parameterIndex, (int)(end * sampleRate), (float)curve["to"]);
+    }
+  }
+
+  // Every field that affects the output, with defaults applied and named values in name order,
+  // so that equivalent requests describe themselves identically. Plugin names are left out, since
+  // several can resolve to the same plugin; callers identify the resolved plugins themselves.
+  String getCanonicalDescription() const {
+    String d;
+    d << "preset=" << presetNumber << ";list=" << (int)listParameters
+      << ";rate=" << sampleRate << ";block=" << blockSize << ";bits=" << bitDepth << ";channels=" << nChannels
+      << ";seconds=" << renderSeconds;
+    if (endOnSilence) d << ";silence=" << silenceThresholdDb << "," << silenceHoldSeconds;
+    if (hasMidiFile) {
+      d << ";midiFile=" << midiFileHash;
+    }
+    else if (notes.size() == 0) {
+      d << ";note=" << midiChannel << "," << midiPitch << "," << midiVelocity << "," << noteSeconds;
+    }
+    for (int i = 0; i < notes.size() && !hasMidiFile; ++i) {
+      const NoteEvent &note = notes.getReference(i);
+      d << ";note=" << note.channel << "," << note.pitch << "," << note.velocity << "," << note.start << "," << note.duration;
+    }
+    d << ";parameters=" << describeSorted(parameters) << ";indexedParameters=" << describeSorted(indexedParameters);
+    if (automation.size() > 0 || indexedAutomation.size() > 0) {
+      d << ";automation=" << describeSorted(automation) << ";indexedAutomation=" << describeSorted(indexedAutomation)
+        << ";step=" << automationStepSamples;
+    }
+    for (int i = 0; i < effects.size(); ++i) {
+      const EffectParameters &effect = effects.getReference(i);
+      d << ";effect=" << effect.presetNumber
+        << "," << describeSorted(effect.parameters) << "," << describeSorted(effect.indexedParameters);
+    }
+    return d;
+  }
+
+  static String describeSorted(const NamedValueSet &values) {
+    StringArray items;
+    for (int i = 0; i < values.size(); ++i) {
+      const var &value = values.getValueAt(i);
+      items.add(values.getName(i).toString() + "=" + (value.isArray() || value.isObject() ? JSON::toString(value, true) : String((float)value)));
+    }
+    items.sort(false);
+    return "{" + items.joinIntoString(",") + "}";
+  }
+
+  int getNumBlocks() const {
+    return (int)(renderSeconds * sampleRate / blockSize);
+  }
+
+  // Plugins always render with at least as many channels as they have, even when the request asks
+  // for fewer, as previews do; the render is then downmixed to nChannels.
+  PluginConfiguration getConfiguration(int pluginChannels = 0) const {
+    return PluginConfiguration(sampleRate, blockSize, jmax(nChannels, pluginChannels));
   }
 
   const char *getFormatName() const {
@@ -104,19 +450,44 @@ struct PluginRequestParameters {
   }
 };
 
-void pluginParametersSet(AudioPluginInstance *instance, const NamedValueSet &parameters) {
-  int numParams = instance->getNumParameters();
-  for (int i = 0; i < numParams; ++i) {
-    Identifier name = instance->getParameterName(i);
-    var val = parameters.getWithDefault(name, var::null);
-    if (!val.isVoid()) {
-      DBG << "Setting named parameter " << i << " - " << name.toString() << " to " << (float)val;
+// Sets the named parameters through the plugin's index, which only visits the names given.
+// Without an index, every parameter's name is asked for and looked up instead.
+void pluginParametersSet(AudioPluginInstance *instance, const NamedValueSet &parameters, const ParameterIndex *index) {
+  if (!index) {
+    int numParams = instance->getNumParameters();
+    for (int i = 0; i < numParams; ++i) {
+      Identifier name = instance->getParameterName(i);
+      var val = parameters.getWithDefault(name, var::null);
+      if (!val.isVoid()) {
+        DBG << "Setting named parameter " << i << " - " << name.toString() << " to " << (float)val;
+        instance->setParameter(i, (float)val);
+        DBG << "... reported as " << instance->getParameter(i) << endl;
+      }
+    }
+    return;
+  }
+
+  for (int j = 0, m = parameters.size(); j < m; ++j) {
+    String name = parameters.getName(j).toString();
+    var val = parameters.getValueAt(j);
+    if (val.isVoid()) continue;
+    for (int i = index->getFirstIndex(name); i >= 0; i = index->getNextIndex(i)) {
+      DBG << "Setting named parameter " << i << " - " << name << " to " << (float)val;
       instance->setParameter(i, (float)val);
       DBG << "... reported as " << instance->getParameter(i) << endl;
     }
   }
 }
 
+// Returns false, logging them, if any of the named parameters or automation curves are not the plugin's.
+bool pluginParameterNamesCheck(const ParameterIndex *index, const NamedValueSet &parameters,
+                               const NamedValueSet &automation) {
+  StringArray unknown;
+  if (!index || (index->hasAllNames(parameters, unknown) & index->hasAllNames(automation, unknown))) return true;
+  DBG << "Unknown parameters: " << unknown.joinIntoString(", ") << endl;
+  return false;
+}
+
 void pluginParametersSetIndexed(AudioPluginInstance *instance, const NamedValueSet &indexedParameters) {
   int numParams = instance->getNumParameters();
   for (int j = 0, m = indexedParameters.size(); j < m; ++j) {
@@ -131,8 +502,452 @@ void pluginParametersSetIndexed(AudioPluginInstance *instance, const NamedValueS
   }
 }
 
+// Resets the instance, then loads the preset and sets parameters, named then indexed.
+void pluginProgramAndParametersSet(AudioPluginInstance *instance, const ParameterIndex *index, int presetNumber,
+                                   const NamedValueSet &parameters, const NamedValueSet &indexedParameters) {
+  // Attempt to reset the plugin in all ways possible.
+  instance->reset();
+  // Setting default parameters here causes miniTERA to become unresponsive to parameter settings.
+  // It's possible that it's effectively pressing some interface buttons that change the editor mode entirely.
+  // It's not necessary anyways if the plugin instance has been freshly created (see above).
+  // pluginParametersOldNewFallback(instance, nullptr, &pluginDefaults); // note that the defaults may be empty
+  instance->setCurrentProgram(0);
+
+  // Load preset if specified, before listing or modifying parameters!
+  if (presetNumber >= 0 && presetNumber < instance->getNumPrograms()) {
+    DBG << "Setting program/preset: " << presetNumber << endl;
+    instance->setCurrentProgram(presetNumber);
+  }
+  int currentProgram = instance->getCurrentProgram();
+  DBG << "Current program/preset: " << currentProgram << " - " << instance->getProgramName(currentProgram) << endl;
+
+  // Set parameters, starting with named, then indexed
+  pluginParametersSet(instance, parameters, index);
+  pluginParametersSetIndexed(instance, indexedParameters);
+}
+
+// Runs processBlock over samples [offset, offset + numSamples) of the buffer, referring to them in
+// place through the given array of channel pointers, with the MIDI events of that range.
+void processSubBlock(AudioPluginInstance *instance, AudioSampleBuffer &buffer, float **channels,
+                     int offset, int numSamples, const MidiSchedule &midiSchedule, int blockStart, MidiBuffer &midiBuffer) {
+  midiSchedule.getBlock(blockStart + offset, numSamples, midiBuffer);
+  const AllocationCounter::ScopedPause pluginCode;
+  if (offset == 0 && numSamples == buffer.getNumSamples()) {
+    instance->processBlock(buffer, midiBuffer);
+    return;
+  }
+  for (int c = 0; c < buffer.getNumChannels(); ++c) channels[c] = buffer.getSampleData(c, offset);
+  AudioSampleBuffer subBuffer(channels, buffer.getNumChannels(), numSamples);
+  instance->processBlock(subBuffer, midiBuffer);
+}
+
+// Buffers reused by every render on a thread, so that steady-state renders do no heap allocation.
+// Each grows to the largest configuration seen on its thread, and is only reallocated to grow further.
+struct RenderScratch {
+  AudioSampleBuffer buffer, effectBuffer, downmixBuffer;
+  MidiBuffer midiBuffer, noMidi;
+  MidiSchedule midiSchedule;
+  ParameterAutomation automation;
+  HeapBlock<float *> channelPointers;
+  int numChannelPointers;
+
+  RenderScratch() : buffer(1, 1), effectBuffer(1, 1), downmixBuffer(1, 1), numChannelPointers(0) {}
+
+  float **getChannelPointers(int numChannels) {
+    if (numChannels > numChannelPointers) {
+      channelPointers.malloc((size_t)numChannels);
+      numChannelPointers = numChannels;
+    }
+    return channelPointers;
+  }
+
+  JUCE_DECLARE_NON_COPYABLE(RenderScratch)
+};
+
+// The RenderScratch of each thread that renders, created at its first render. Render and HTTP threads
+// live as long as the server and keep theirs; threads that live for one request release theirs.
+class RenderScratches {
+public:
+  RenderScratches() {}
+
+  RenderScratch &getForCurrentThread() {
+    Thread::ThreadID thread = Thread::getCurrentThreadId();
+    const ScopedLock sl(lock);
+    int i = threads.indexOf(thread);
+    if (i < 0) {
+      i = threads.size();
+      threads.add(thread);
+      scratches.add(new RenderScratch());
+    }
+    return *scratches.getUnchecked(i);
+  }
+
+  void releaseForCurrentThread() {
+    const ScopedLock sl(lock);
+    int i = threads.indexOf(Thread::getCurrentThreadId());
+    if (i < 0) return;
+    threads.remove(i);
+    scratches.remove(i);
+  }
+
+private:
+  CriticalSection lock;
+  Array<Thread::ThreadID> threads;
+  OwnedArray<RenderScratch> scratches; // parallel to threads
+
+  JUCE_DECLARE_NON_COPYABLE(RenderScratches)
+};
+static RenderScratches renderScratches;
+
+// The most channels the plugin takes in or puts out, which its processBlock() buffers must have.
+static int getPluginChannels(const AudioPluginInstance *instance) {
+  return jmax(instance->getNumInputChannels(), instance->getNumOutputChannels());
+}
+
+// Returns the block with at most numChannels channels, averaging each extra channel into channel
+// ch % numChannels of out, so that a stereo plugin rendered in mono is heard as (L + R) / 2.
+static const AudioSampleBuffer &downmix(const AudioSampleBuffer &block, int numChannels, int numSamples,
+                                        AudioSampleBuffer &out) {
+  int blockChannels = block.getNumChannels();
+  if (blockChannels <= numChannels) return block;
+  out.setSize(numChannels, numSamples, false, false, true);
+  out.clear(0, numSamples);
+  for (int ch = 0; ch < blockChannels; ++ch) {
+    int target = ch % numChannels;
+    int numFolded = (blockChannels - target + numChannels - 1) / numChannels;
+    out.addFrom(target, 0, block, ch, 0, numSamples, 1.0f / numFolded);
+  }
+  return out;
+}
+
+// Returns a sink that encodes blocks in the request's format onto the stream, or nullptr.
+AudioBlockSink *createEncodingSink(const PluginRequestParameters &params, OutputStream &ostream) {
+  AudioFormat *outputFormat = outputFormats.findFormatForFileExtension(params.getFormatName());
+  if (!outputFormat) return nullptr;
+
+  // The writer takes ownership of the output stream; the  writer will delete it when the writer leaves scope.
+  // Therefore, we pass a special pointer class that does not allow the writer to delete it.
+  ScopedPointer<OutputStream> ostreamNonDeleting(new NonDeletingOutputStream(&ostream));
+  AudioFormatWriter *writer = outputFormat->createWriterFor(ostreamNonDeleting,
+    params.sampleRate, params.nChannels, params.bitDepth,
+    StringPairArray(), 0);
+  if (!writer) return nullptr;
+  ostreamNonDeleting.release(); // now owned by the writer
+  return new AudioWriterSink(writer);
+}
+
+bool handlePluginRequest(const PluginRequestParameters &params, OutputStream &ostream,
+                         AudioBlockSink *sink, ThreadSafePlugin *plugin);
+bool handleVoicesInParallel(const PluginRequestParameters &params, OutputStream &ostream, AudioBlockSink *sink);
+
+// The number of lanes that numRequests requests for a plugin render in at once: at most maxLanes, and
+// no more than the worker processes, or the plugin's pool, can serve at a time.
+static int getNumLanes(const PluginEntry *entry, int numRequests, int maxLanes) {
+  int numLanes = jmin(numRequests, jmax(1, maxLanes));
+  if (workerPool.isEnabled()) return jmin(numLanes, serverOptions.workerProcesses);
+  if (entry->settings.poolLimits.maxSize > 0) numLanes = jmin(numLanes, entry->settings.poolLimits.maxSize);
+  return numLanes;
+}
+
+// An instance of a registry entry's plugin for serving one or more requests: either leased from
+// the entry's pool, or fresh. It is returned to the pool, or retired for background deletion,
+// when leaving scope. get() returns nullptr if no instance could be had.
+class ScopedRequestInstance {
+public:
+  // A reusable fresh instance captures its baseline state, so it can be reset between requests.
+  ScopedRequestInstance(PluginEntry *_entry, const PluginRequestParameters &params, bool reusable = false)
+    : entry(_entry), plugin(nullptr) {
+    if (entry->pool) {
+      // Wait in line for a plugin from the pool.
+      PluginPool &pool = *entry->pool;
+      plugin = pool.acquire(Time::getMillisecondCounter() + params.timeoutMillis, params.getConfiguration(entry->numChannels));
+      if (!plugin) {
+        DBG << "Timeout after " << params.timeoutMillis << "ms with " << pool.getNumWaiting() << " waiting" << endl;
+        return;
+      }
+      if (!restore()) release();
+    }
+    else {
+      // Take a prepared instance if one is ready, and leave its deletion to the background thread.
+      AudioPluginInstance *instance = entry->prewarmed ? entry->prewarmed->take() : nullptr;
+      if (!instance) instance = entry->createInstance();
+      if (!instance) return;
+      temporaryPlugin = new ThreadSafePlugin(instance);
+      if (reusable) temporaryPlugin->captureBaseline();
+      plugin = temporaryPlugin;
+    }
+    if (plugin) plugin->parameterIndex = entry->parameterIndex;
+  }
+
+  ~ScopedRequestInstance() {
+    release();
+  }
+
+  ThreadSafePlugin *get() const {
+    return plugin;
+  }
+
+  bool isPooled() const {
+    return plugin && !temporaryPlugin;
+  }
+
+  // Makes the instance behave as if freshly created again, before the next request of a batch.
+  // On failure the instance is given up, and get() returns nullptr.
+  bool resetForNextRequest() {
+    if (!plugin) return false;
+    if (!plugin->quarantined && restore()) return true;
+    release();
+    return false;
+  }
+
+private:
+  // Pooled instances must behave as if freshly created, so restore their baseline state,
+  // and fall back to recreating any instance whose state did not restore cleanly.
+  bool restore() {
+    if (isPooled() && !serverOptions.poolRestoreState) return true;
+    if (plugin->restoreBaseline()) return true;
+    DBG << "Baseline state did not restore, recreating instance" << endl;
+    AudioPluginInstance *instance = entry->createInstance();
+    if (!instance) return false;
+    plugin->replaceInstance(instance);
+    return true;
+  }
+
+  void release() {
+    if (temporaryPlugin) {
+      if (entry->prewarmed) entry->prewarmed->retire(temporaryPlugin->instance.release());
+      temporaryPlugin = nullptr;
+    }
+    else if (plugin) {
+      entry->pool->release(plugin);
+    }
+    plugin = nullptr;
+  }
+
+  PluginEntry *entry;
+  ThreadSafePlugin *plugin;
+  ScopedPointer<ThreadSafePlugin> temporaryPlugin;
+
+  JUCE_DECLARE_NON_COPYABLE(ScopedRequestInstance)
+};
+
+// A request's effects, each leased from its own plugin's pool (or fresh) for the length of the render,
+// and run in order over every block on its way from the instrument to the sink. This computes what a
+// serial AudioProcessorGraph would, while the instances stay pooled by the registry.
+class EffectChain : public AudioBlockSink {
+public:
+  EffectChain() : destination(nullptr), scratch(nullptr), numChannels(0), outputChannels(0), measureOutput(false),
+                  lastMagnitude(0) {}
+
+  // Acquires and sets up the request's effects, which must happen before the instrument is leased.
+  // Returns false if any is unavailable.
+  bool acquire(const PluginRequestParameters &params, const PluginEntry *instrument) {
+    if (params.listParameters) return true; // listings only concern the instrument
+    int numEffects = params.effects.size();
+    Array<PluginEntry *> effectEntries;
+    for (int i = 0; i < numEffects; ++i) {
+      const EffectParameters &effect = params.effects.getReference(i);
+      PluginEntry *entry = effect.plugin.isEmpty() ? nullptr : pluginRegistry.acquire(effect.plugin);
+      entries.add(new ScopedPluginEntry(pluginRegistry, entry));
+      if (!entry) {
+        DBG << "Unknown or unloadable effect: " << effect.plugin << endl;
+        return false;
+      }
+      effectEntries.add(entry);
+    }
+
+    // A request that uses a pooled plugin more often than its pool can ever lease would wait on itself.
+    // The instrument, leased after the effects, counts too.
+    for (int i = 0; i < numEffects; ++i) {
+      PluginEntry *entry = effectEntries[i];
+      int uses = entry == instrument ? 1 : 0;
+      for (int j = 0; j < numEffects; ++j) uses += effectEntries[j] == entry ? 1 : 0;
+      if (entry->settings.poolLimits.maxSize > 0 && uses > entry->settings.poolLimits.maxSize) {
+        DBG << "Effect " << entry->name << " is used " << uses << " times, but its pool holds at most "
+            << entry->settings.poolLimits.maxSize << endl;
+        return false;
+      }
+    }
+
+    // Every request leases its effects in the same order, by plugin name, and only then its instrument,
+    // so that two requests can never each hold an instance the other is waiting for.
+    struct ByPluginName {
+      const Array<PluginEntry *> &effectEntries;
+      ByPluginName(const Array<PluginEntry *> &_effectEntries) : effectEntries(_effectEntries) {}
+      int compareElements(int a, int b) const {
+        return effectEntries[a]->name.compareIgnoreCase(effectEntries[b]->name);
+      }
+    } byPluginName(effectEntries);
+    Array<int> leaseOrder;
+    for (int i = 0; i < numEffects; ++i) {
+      leaseOrder.add(i);
+      instances.add(nullptr);
+    }
+    leaseOrder.sort(byPluginName, true);
+    for (int k = 0; k < numEffects; ++k) {
+      int i = leaseOrder[k];
+      instances.set(i, new ScopedRequestInstance(effectEntries[i], params));
+      if (!instances[i]->get()) return false;
+    }
+
+    for (int i = 0; i < numEffects; ++i) {
+      const EffectParameters &effect = params.effects.getReference(i);
+      ThreadSafePlugin *plugin = instances[i]->get();
+      if (!pluginParameterNamesCheck(plugin->parameterIndex, effect.parameters, NamedValueSet())) return false;
+      {
+        const ScopedLock pluginLock(plugin->crit);
+        pluginProgramAndParametersSet(plugin->instance, plugin->parameterIndex, effect.presetNumber,
+                                      effect.parameters, effect.indexedParameters);
+      }
+      PluginConfiguration config = params.getConfiguration(getPluginChannels(plugin->instance));
+      plugin->prepare(config);
+      numChannels = jmax(numChannels, config.nChannels);
+      // Effect blocks are timed like the instrument's, so a hung effect gets quarantined too.
+      watches.add(new RenderWatchdog::Watch(renderWatchdog, plugin, config));
+    }
+    outputChannels = params.nChannels;
+    return true;
+  }
+
+  // Puts the chain in front of the sink, first creating a sink that encodes onto the stream if there is none.
+  // Leaves the sink alone if there are no effects. Returns false if no encoder could be created.
+  bool wrap(const PluginRequestParameters &params, OutputStream &ostream, AudioBlockSink *&sink) {
+    if (instances.size() == 0 || params.listParameters) return true;
+    if (!sink) {
+      encoder = createEncodingSink(params, ostream);
+      if (!encoder) return false;
+      sink = encoder;
+    }
+    destination = sink;
+    sink = this;
+    measureOutput = params.endOnSilence;
+    return true;
+  }
+
+  // The peak level of the last block the effects put out, if the request ends on silence.
+  // Silence is judged on this rather than on the instrument, so that reverb and delay tails are kept.
+  float getLastMagnitude() const {
+    return lastMagnitude;
+  }
+
+  // Runs on the render thread, so the effects work in that thread's scratch buffer. The effects get
+  // as many channels as the widest of them has, a narrower block's channels being repeated to fill
+  // them, and what they put out is downmixed to the request's channels.
+  bool writeBlock(const AudioSampleBuffer &block, int numSamples) {
+    if (!scratch) scratch = &renderScratches.getForCurrentThread();
+    AudioSampleBuffer &buffer = scratch->effectBuffer;
+    int blockChannels = block.getNumChannels();
+    buffer.setSize(jmax(blockChannels, numChannels), numSamples, false, false, true);
+    for (int ch = 0; ch < buffer.getNumChannels(); ++ch) buffer.copyFrom(ch, 0, block, ch % blockChannels, 0, numSamples);
+    for (int i = 0; i < instances.size(); ++i) {
+      ThreadSafePlugin *plugin = instances[i]->get();
+      RenderWatchdog::Watch &watch = *watches[i];
+      {
+        const ScopedLock pluginLock(plugin->crit);
+        const AllocationCounter::ScopedPause pluginCode;
+        watch.beginBlock();
+        plugin->instance->processBlock(buffer, scratch->noMidi);
+      }
+      if (!watch.endBlock()) {
+        DBG << "Aborting render: effect " << i << " took longer than " << watch.getBudgetMillis() << "ms" << endl;
+        return false;
+      }
+    }
+    if (measureOutput) lastMagnitude = buffer.getMagnitude(0, numSamples);
+    return destination->writeBlock(downmix(buffer, outputChannels, numSamples, scratch->downmixBuffer), numSamples);
+  }
+
+private:
+  OwnedArray<ScopedPluginEntry> entries;
+  OwnedArray<ScopedRequestInstance> instances; // declared after entries, so they are released first
+  OwnedArray<RenderWatchdog::Watch> watches; // one per instance, declared after them so they stop first
+  ScopedPointer<AudioBlockSink> encoder;
+  AudioBlockSink *destination;
+  RenderScratch *scratch; // the render thread's, found at the first block
+  int numChannels, outputChannels; // of the widest effect, and of the request
+  bool measureOutput;
+  float lastMagnitude;
+
+  JUCE_DECLARE_NON_COPYABLE(EffectChain)
+};
+
+// Writes a parameter listing from a preset's snapshot, with the request's parameters patched over it
+// as they would be set, named then indexed. Values are reported as requested, not as the plugin would
+// round them.
+void writeParameterList(const ParameterListCache::Snapshot &snapshot, const PluginRequestParameters &params,
+                        OutputStream &ostream) {
+  if (params.parameters.size() == 0 && params.indexedParameters.size() == 0) {
+    ostream.write(snapshot.json.toRawUTF8(), snapshot.json.getNumBytesAsUTF8());
+    return;
+  }
+
+  Array<float> values(snapshot.values);
+  const ParameterIndex &index = *snapshot.metadata->parameterIndex;
+  for (int j = 0, m = params.parameters.size(); j < m; ++j) {
+    var val = params.parameters.getValueAt(j);
+    if (val.isVoid()) continue;
+    for (int i = index.getFirstIndex(params.parameters.getName(j).toString()); i >= 0; i = index.getNextIndex(i)) {
+      values.set(i, (float)val);
+    }
+  }
+  for (int j = 0, m = params.indexedParameters.size(); j < m; ++j) {
+    int i = params.indexedParameters.getName(j).toString().getIntValue();
+    var val = params.indexedParameters.getValueAt(j);
+    if (!val.isVoid() && i >= 0 && i < values.size()) values.set(i, (float)val);
+  }
+  JSON::writeToStream(ostream, snapshot.describe(values));
+}
+
+// Handles a request with an acquired plugin on its home render thread, if there are render threads.
+// Fresh instances have no home, so they go to the least busy thread.
+bool handlePluginRequestOnRenderThread(const PluginRequestParameters &params, OutputStream &ostream,
+                                       AudioBlockSink *sink, ThreadSafePlugin *plugin, bool pooled) {
+  if (!renderThreads.isEnabled()) return handlePluginRequest(params, ostream, sink, plugin);
+
+  // Output handed off to this thread is sent from here while the job runs, since the render thread
+  // must not wait on a client. Everything the job writes, through a sink or not, ends up there.
+  HandoffOutputStream *handoff = dynamic_cast<HandoffOutputStream *>(&ostream);
+  if (handoff && !handoff->isOwnedByCurrentThread()) handoff = nullptr;
+
+  struct RenderJob : public RenderThreadPool::Job {
+    const PluginRequestParameters &params;
+    OutputStream &ostream;
+    AudioBlockSink *sink;
+    ThreadSafePlugin *plugin;
+    HandoffOutputStream *handoff;
+    bool result;
+
+    RenderJob(const PluginRequestParameters &_params, OutputStream &_ostream, AudioBlockSink *_sink,
+              ThreadSafePlugin *_plugin, HandoffOutputStream *_handoff)
+      : params(_params), ostream(_ostream), sink(_sink), plugin(_plugin), handoff(_handoff), result(false) {}
+
+    void run() {
+      result = handlePluginRequest(params, ostream, sink, plugin);
+      if (handoff) handoff->finishWriting();
+    }
+  } job(params, ostream, sink, plugin, handoff);
+
+  struct SendJob : public RenderThreadPool::Job {
+    HandoffOutputStream &handoff;
+    SendJob(HandoffOutputStream &_handoff) : handoff(_handoff) {}
+    void run() { handoff.sendUntilFinished(); }
+  };
+  ScopedPointer<SendJob> send(handoff ? new SendJob(*handoff) : nullptr);
+
+  if (pooled && plugin->homeThread < 0) plugin->homeThread = renderThreads.assignHomeThread();
+  renderThreads.runAndWait(job, pooled ? plugin->homeThread : -1, send);
+  return job.result;
+}
+
+// Handles a request, writing the parameter listing or encoded audio to the stream.
+// If a sink is given, rendered audio goes to it block by block instead of being encoded.
 bool handlePluginRequest(const PluginRequestParameters &params, OutputStream &ostream, 
-                         ThreadSafePlugin *plugin = nullptr) {
+                         AudioBlockSink *sink = nullptr, ThreadSafePlugin *plugin = nullptr) {
+  if (params.midiFileError.isNotEmpty()) {
+    DBG << params.midiFileError << endl;
+    return false;
+  }
+
   if (!plugin) {
     // It's very possible that all of this was a premature optimization.
     // For VSTs at least, code loading and caching is handled by ModuleHandle::findOrCreateModule,
@@ -140,180 +955,649 @@ bool handlePluginRequest(const PluginRequestParameters &params, OutputStream &os
     // On the other hand, we want to make sure that each audio request has a "fresh" instance.
     // The easiest way to do this is by bypassing the instance pool and instantiating on demand.
 
-    #if PLUGIN_POOL_SIZE
-
-    // Recurse with a plugin from the pool, locking on it.
-    // Keep trying with a delay until a timeout occurs.
-    const int TIMEOUT = 5000, WAIT = 200;
-    int64 startTime = Time::currentTimeMillis();
+    // With worker processes, plugins never run in this process at all.
+    if (workerPool.isEnabled()) {
+      ScopedPointer<AudioBlockSink> encoder;
+      if (!sink && !params.listParameters) {
+        encoder = createEncodingSink(params, ostream);
+        if (!encoder) return false;
+        sink = encoder;
+      }
+      return workerPool.handle(params.request, params.listParameters, params.getConfiguration(),
+                               Time::getMillisecondCounter() + params.timeoutMillis, ostream, sink);
+    }
 
-    while (Time::currentTimeMillis() < startTime + TIMEOUT) {
-      int i = 0;
-      while ((plugin = pluginPool[i++])) {
-        const ScopedTryLock pluginTryLock(plugin->crit);
-        if (pluginTryLock.isLocked()) {
-          DBG << "Handling with plugin " << i << endl;
-          return handlePluginRequest(params, ostream, plugin);
-        }
+    // Listings are answered from the plugin's snapshot of the preset, once there is one.
+    if (params.listParameters) {
+      ParameterListCache::Snapshot::Ptr snapshot =
+        parameterListCache.get(pluginRegistry.getVersion(params.plugin), params.presetNumber);
+      if (snapshot) {
+        writeParameterList(*snapshot, params, ostream);
+        return true;
       }
-      DBG << "Trying again in " << WAIT << endl;
-      Thread::sleep(WAIT);
     }
 
-    // If we were unable to obtain a lock, return failure.
-    DBG << "Timeout" << endl;
-    return false;
+    ScopedPluginEntry entry(pluginRegistry, pluginRegistry.acquire(params.plugin));
+    if (!entry) {
+      DBG << "Unknown or unloadable plugin: " << params.plugin << endl;
+      return false;
+    }
 
-    #else
+    EffectChain effects;
+    if (!effects.acquire(params, entry) || !effects.wrap(params, ostream, sink)) return false;
 
-    ThreadSafePlugin temporaryPlugin(createSynthInstance());
-    return handlePluginRequest(params, ostream, &temporaryPlugin);
+    // Chords and the like render one note per instance at once, for plugins whose notes never interact.
+    // With a single lane the voices would only render one after another, so the chord renders whole.
+    if (entry->independentVoices && params.notes.size() > 1 && !params.listParameters
+        && !params.hasMidiFile && !params.endOnSilence
+        && getNumLanes(entry, params.notes.size(), serverOptions.batchMaxLanes) > 1) {
+      return handleVoicesInParallel(params, ostream, sink);
+    }
 
-    #endif
+    ScopedRequestInstance instance(entry, params);
+    if (!instance.get()) return false;
+    return handlePluginRequestOnRenderThread(params, ostream, sink, instance.get(), instance.isPooled());
   }
   else {
     // Re-acquire or acquire the lock.
     const ScopedLock pluginLock(plugin->crit);
     AudioPluginInstance *instance = plugin->instance; // unmanaged, for simplicity
 
-    // Attempt to reset the plugin in all ways possible.
+    // A listing only uses the instance to snapshot its preset, after which the cache answers it.
+    if (params.listParameters) {
+      DBG << "Snapshotting parameter list: # parameters " << instance->getNumParameters() << endl;
+      pluginProgramAndParametersSet(instance, plugin->parameterIndex, params.presetNumber, NamedValueSet(), NamedValueSet());
+      ParameterListCache::Snapshot::Ptr snapshot =
+        parameterListCache.add(pluginRegistry.getVersion(params.plugin), params.presetNumber, instance);
+      writeParameterList(*snapshot, params, ostream);
+      return true;
+    }
+
+    // Unknown names are rejected before anything is set, rather than silently ignored.
+    if (!pluginParameterNamesCheck(plugin->parameterIndex, params.parameters, params.automation)) return false;
+    pluginProgramAndParametersSet(instance, plugin->parameterIndex, params.presetNumber,
+                                  params.parameters, params.indexedParameters);
+
+    // Now attempt to render audio, encoding it onto the stream unless the caller wants the blocks.
+    ScopedPointer<AudioBlockSink> encoder;
+    if (!sink) {
+      encoder = createEncodingSink(params, ostream);
+      if (!encoder) return false;
+      sink = encoder;
+    }
+
+    // A plugin always renders all of its channels, and the render is downmixed if the request has fewer.
+    PluginConfiguration config = params.getConfiguration(getPluginChannels(instance));
+    plugin->prepare(config);
+
+    // Everything the render uses comes from this thread's scratch buffers, so it allocates nothing
+    // once they have grown to fit.
+    RenderScratch &scratch = renderScratches.getForCurrentThread();
+    int64 allocationsBefore = AllocationCounter::get();
+
+    // Schedule the notes for the whole render; each block gets the events that fall within it.
+    MidiSchedule &midiSchedule = scratch.midiSchedule;
+    params.scheduleMidi(midiSchedule);
+    midiSchedule.splitIntoBlocks(params.blockSize);
+    MidiBuffer &midiBuffer = scratch.midiBuffer;
+
+    // Automation splits blocks wherever a parameter changes, so that changes land on exact samples.
+    ParameterAutomation &automation = scratch.automation;
+    params.scheduleAutomation(instance, plugin->parameterIndex, automation);
+    float **subBlockChannels = scratch.getChannelPointers(config.nChannels);
+
+    // Every block is timed, and the render is abandoned if the plugin overruns its budget.
+    RenderWatchdog::Watch watch(renderWatchdog, plugin, config);
+
+    // With endOnSilence, once the last MIDI event has been delivered, the render ends as soon as the
+    // peak level has stayed below the threshold for the hold time. The writer then finalizes the
+    // file at that length. With effects, the level is that of their output.
+    const EffectChain *effectChain = dynamic_cast<const EffectChain *>(sink);
+    int lastEventTime = midiSchedule.getLastEventTime();
+    float silenceThreshold = Decibels::decibelsToGain(params.silenceThresholdDb);
+    int silenceHoldSamples = (int)(params.silenceHoldSeconds * params.sampleRate);
+    int silentSamples = 0;
+
+    AudioSampleBuffer &buffer = scratch.buffer;
+    buffer.setSize(config.nChannels, params.blockSize, false, false, true);
+    buffer.clear();
+    int numBuffers = params.getNumBlocks();
+    for (int i = 0; i < numBuffers; ++i) {
+      // DBG << "Processing block " << i << "..." << flush;
+      int blockStart = i * params.blockSize;
+      watch.beginBlock();
+      for (int offset = 0; offset < params.blockSize;) {
+        int end = jmin(params.blockSize, automation.getNextChangeAfter(blockStart + offset) - blockStart);
+        automation.apply(instance, blockStart + offset);
+        processSubBlock(instance, buffer, subBlockChannels, offset, end - offset, midiSchedule, blockStart, midiBuffer);
+        offset = end;
+      }
+      if (!watch.endBlock()) {
+        DBG << "Aborting render: block " << i << " took longer than " << watch.getBudgetMillis() << "ms" << endl;
+        return false;
+      }
+      // DBG << " left RMS level " << buffer.getRMSLevel(0, 0, params.blockSize) << endl;
+      // Effects take every channel, and downmix what they put out themselves.
+      const AudioSampleBuffer &block =
+        effectChain ? buffer : downmix(buffer, params.nChannels, params.blockSize, scratch.downmixBuffer);
+      if (!sink->writeBlock(block, params.blockSize)) return false;
+
+      if (params.endOnSilence && i * params.blockSize > lastEventTime) {
+        float magnitude = effectChain ? effectChain->getLastMagnitude() : buffer.getMagnitude(0, params.blockSize);
+        silentSamples = magnitude < silenceThreshold ? silentSamples + params.blockSize : 0;
+        if (silentSamples >= silenceHoldSamples) {
+          DBG << "Ending render on silence after " << (i + 1) << " of " << numBuffers << " blocks" << endl;
+          break;
+        }
+      }
+    }
+
     instance->reset();
-    // Setting default parameters here causes miniTERA to become unresponsive to parameter settings.
-    // It's possible that it's effectively pressing some interface buttons that change the editor mode entirely.
-    // It's not necessary anyways if the plugin instance has been freshly created (see above).
-    // pluginParametersOldNewFallback(instance, nullptr, &pluginDefaults); // note that the defaults may be empty
-    instance->setCurrentProgram(0);
 
-    // Load preset if specified, before listing or modifying parameters!
-    if (params.presetNumber >= 0 && params.presetNumber < instance->getNumPrograms()) {
-      DBG << "Setting program/preset: " << params.presetNumber << endl;
-      instance->setCurrentProgram(params.presetNumber);
+    if (AllocationCounter::isEnabled()) {
+      DBG << "Render allocations, excluding the plugin's own: " << (AllocationCounter::get() - allocationsBefore) << endl;
     }
-    int currentProgram = instance->getCurrentProgram();
-    DBG << "Current program/preset: " << currentProgram << " - " << instance->getProgramName(currentProgram) << endl;
 
-    // Set parameters, starting with named, then indexed
-    pluginParametersSet(instance, params.parameters);
-    pluginParametersSetIndexed(instance, params.indexedParameters);
+    return true;
+  }
+}
+
+// Runs a job forwarded by the server, when this process is a worker.
+bool handleWorkerRequest(const var &request, bool listParameters, OutputStream &ostream, AudioBlockSink *sink) {
+  PluginRequestParameters params(request);
+  params.listParameters = listParameters;
+  return handlePluginRequest(params, ostream, sink);
+}
 
-    // If parameters requested, output them and return
-    if (params.listParameters) {
-      DBG << "Rendering parameter list: # parameters " << instance->getNumPrograms() << endl;
-
-      // Output each parameter setting in two places: 
-      // an indexed array and a dictionary by name
-      // All DynamicObjects created will be freed when their var's leave scope.
-      DynamicObject *outer = new DynamicObject();
-      DynamicObject *innerParams = new DynamicObject();
-      var indexedParamVar;
-      {
-        for (int i = 0, n = instance->getNumParameters(); i < n; ++i) {
-          String name = instance->getParameterName(i);
-          float val = instance->getParameter(i);
-          innerParams->setProperty(name, val);
-
-          DynamicObject *indexedInnerObj = new DynamicObject();
-          indexedInnerObj->setProperty("index", i);
-          indexedInnerObj->setProperty("name", name);
-          indexedInnerObj->setProperty("value", val);
-          indexedParamVar.append(var(indexedInnerObj)); // frees indexedInnerObj when this scope ends
+// A batch of requests, given as a "requests" array whose entries default to the batch's other fields.
+// The requests for each plugin are sorted by configuration and shared among a few lanes, each of
+// which acquires one instance and keeps it for request after request, resetting it in between,
+// so that acquisition and preparation are paid once per lane rather than once per request.
+// Results are collected as they complete, in any order.
+class RenderBatch {
+public:
+  struct Item {
+    int index; // position in the "requests" array
+    PluginRequestParameters params;
+    ScopedPointer<MemoryOutputStream> output; // may be freed once the result has been handed over
+    AudioBlockSink *sink; // if set, receives the rendered blocks instead of output
+    bool result;
+
+    Item(int _index, const var &request)
+      : index(_index), params(request), output(new MemoryOutputStream()), sink(nullptr), result(false) {}
+  };
+
+  RenderBatch(const var &batch) : numPending(0) {
+    if (const Array<var> *requests = batch["requests"].getArray()) {
+      for (int i = 0; i < requests->size(); ++i) {
+        Item *item = new Item(i, mergeRequest(batch, requests->getReference(i)));
+        getGroup(item->params.plugin)->items.add(item);
+        ++numPending;
+      }
+    }
+    for (int i = 0; i < groups.size(); ++i) {
+      ItemComparator comparator;
+      groups[i]->items.sort(comparator, true);
+    }
+  }
+
+  ~RenderBatch() {
+    {
+      const ScopedLock sl(lock);
+      for (int i = 0; i < groups.size(); ++i) groups[i]->nextItem = groups[i]->items.size();
+    }
+    lanes.clear(); // each lane finishes its current request in its destructor
+  }
+
+  int size() const {
+    int total = 0;
+    for (int i = 0; i < groups.size(); ++i) total += groups[i]->items.size();
+    return total;
+  }
+
+  // Sends the blocks of the request at the given index to the sink, which must outlive the batch.
+  void setSink(int index, AudioBlockSink *sink) {
+    for (int i = 0; i < groups.size(); ++i) {
+      for (int j = 0; j < groups[i]->items.size(); ++j) {
+        if (groups[i]->items[j]->index == index) groups[i]->items[j]->sink = sink;
+      }
+    }
+  }
+
+  // Starts rendering, with at most maxLanes lanes for each plugin.
+  void start(int maxLanes) {
+    for (int i = 0; i < groups.size(); ++i) {
+      Group *group = groups[i];
+      int numLanes = 0;
+      if (workerPool.isEnabled()) {
+        numLanes = getNumLanes(nullptr, group->items.size(), maxLanes);
+      }
+      else {
+        group->entry = new ScopedPluginEntry(pluginRegistry, pluginRegistry.acquire(group->plugin));
+        if (!*group->entry) {
+          DBG << "Unknown or unloadable plugin: " << group->plugin << endl;
         }
+        else {
+          numLanes = getNumLanes(*group->entry, group->items.size(), maxLanes);
+        }
+      }
+      if (numLanes == 0) {
+        while (Item *item = takeNext(*group)) finish(item, false);
+      }
+      for (int j = 0; j < numLanes; ++j) {
+        Lane *lane = new Lane(*this, *group);
+        lanes.add(lane);
+        lane->startThread();
       }
-      outer->setProperty(Identifier("parameters"), var(innerParams));
-      outer->setProperty(Identifier("indexedParameters"), indexedParamVar);
+    }
+  }
 
-      // List presets/programs.
-      var progVar;
+  // Blocks until another request has completed and returns it, or returns nullptr once all have.
+  Item *waitForNextResult() {
+    for (;;) {
       {
-        for (int i = 0, n = instance->getNumPrograms(); i < n; ++i) {
-          progVar.append(var(instance->getProgramName(i)));
+        const ScopedLock sl(lock);
+        if (completed.size() > 0) return completed.removeAndReturn(0);
+        if (numPending == 0) return nullptr;
+      }
+      itemCompleted.wait(-1);
+    }
+  }
+
+private:
+  // The requests for one plugin, which its lanes take in order.
+  struct Group {
+    String plugin;
+    OwnedArray<Item> items;
+    int nextItem;
+    ScopedPointer<ScopedPluginEntry> entry; // not used with worker processes
+
+    Group(const String &_plugin) : plugin(_plugin), nextItem(0) {}
+  };
+
+  // Requests with the same configuration are adjacent, so that a lane rarely has to prepare again.
+  struct ItemComparator {
+    static int compareElements(const Item *first, const Item *second) {
+      const PluginRequestParameters &a = first->params, &b = second->params;
+      if (a.sampleRate != b.sampleRate) return a.sampleRate < b.sampleRate ? -1 : 1;
+      if (a.blockSize != b.blockSize) return a.blockSize < b.blockSize ? -1 : 1;
+      if (a.nChannels != b.nChannels) return a.nChannels < b.nChannels ? -1 : 1;
+      return 0;
+    }
+  };
+
+  // Runs requests of one group back to back until none are left.
+  class Lane : public Thread {
+  public:
+    Lane(RenderBatch &_batch, Group &_group) : Thread("batch lane"), batch(_batch), group(_group) {}
+
+    ~Lane() {
+      stopThread(-1);
+    }
+
+    void run() {
+      // Worker processes keep their own instances, so each request is simply forwarded.
+      if (workerPool.isEnabled()) {
+        while (Item *item = batch.takeNext(group)) batch.finish(item, handlePluginRequest(item->params, *item->output, item->sink));
+        return;
+      }
+
+      ScopedPointer<ScopedRequestInstance> instance;
+      while (Item *item = batch.takeNext(group)) {
+        // Effects are leased before the instrument, as for every other request, so a pooled instrument
+        // kept from the last request goes back to its pool while they are.
+        if (instance && instance->isPooled() && item->params.effects.size() > 0) instance = nullptr;
+        if (instance && !instance->resetForNextRequest()) instance = nullptr;
+        bool result;
+        {
+          // The chain's encoder finishes the output when leaving this scope, before the result is handed over.
+          EffectChain effects;
+          AudioBlockSink *sink = item->sink;
+          result = effects.acquire(item->params, *group.entry);
+          if (result && !instance) instance = new ScopedRequestInstance(*group.entry, item->params, true /* reusable */);
+          result = result && instance->get() && effects.wrap(item->params, *item->output, sink)
+            && handlePluginRequestOnRenderThread(item->params, *item->output, sink, instance->get(), instance->isPooled());
         }
+        batch.finish(item, result);
       }
-      outer->setProperty(Identifier("presets"), progVar);
+      renderScratches.releaseForCurrentThread(); // the lane's thread ends with the batch
+    }
 
-      var outerVar(outer);
-      JSON::writeToStream(ostream, outerVar);
-      // DBG << JSON::toString(outerVar, true /* allOnOneLine */) << endl;
+  private:
+    RenderBatch &batch;
+    Group &group;
+  };
 
-      return true;
+  // Returns a request's fields, with the batch's fields for those it does not give.
+  static var mergeRequest(const var &batch, const var &request) {
+    DynamicObject *merged = new DynamicObject(); // freed when the returned var leaves scope
+    var result(merged);
+    if (DynamicObject *batchObj = batch.getDynamicObject()) {
+      const NamedValueSet &fields = batchObj->getProperties();
+      for (int i = 0; i < fields.size(); ++i) {
+        if (fields.getName(i) != Identifier("requests")) merged->setProperty(fields.getName(i), fields.getValueAt(i));
+      }
     }
+    if (DynamicObject *requestObj = request.getDynamicObject()) {
+      const NamedValueSet &fields = requestObj->getProperties();
+      for (int i = 0; i < fields.size(); ++i) merged->setProperty(fields.getName(i), fields.getValueAt(i));
+    }
+    return result;
+  }
 
-    // Now attempt to render audio.
-    AudioFormatManager formatManager;
-    formatManager.registerBasicFormats();
-    OptionalScopedPointer<AudioFormat> outputFormat(formatManager.findFormatForFileExtension(params.getFormatName()), false);
-    if (!outputFormat) return false;
-
-    instance->setNonRealtime(true);
-    instance->prepareToPlay(params.sampleRate, params.blockSize);
-    instance->setNonRealtime(true);
-
-    // The writer takes ownership of the output stream; the  writer will delete it when the writer leaves scope.
-    // Therefore, we pass a special pointer class that does not allow the writer to delete it.
-    OutputStream *ostreamNonDeleting = new NonDeletingOutputStream(&ostream);
-    ScopedPointer<AudioFormatWriter> writer(outputFormat->createWriterFor(ostreamNonDeleting,
-      params.sampleRate, params.nChannels, params.bitDepth,
-      StringPairArray(), 0));
-
-    // Create a MIDI buffer
-    MidiBuffer midiBuffer;
-    midiBuffer.addEvent(MidiMessage::noteOn(params.midiChannel, (uint8)params.midiPitch, (uint8)params.midiVelocity),
-                        0 /* time */);
-    midiBuffer.addEvent(MidiMessage::allNotesOff(params.midiChannel), 
-                        params.noteSeconds * params.sampleRate);
-
-    AudioSampleBuffer buffer(params.nChannels, params.blockSize);
-    int numBuffers = (int)(params.renderSeconds * params.sampleRate / params.blockSize);
-    for (int i = 0; i < numBuffers; ++i) {
-      // DBG << "Processing block " << i << "..." << flush;
-      instance->processBlock(buffer, midiBuffer);
-      // DBG << " left RMS level " << buffer.getRMSLevel(0, 0, params.blockSize) << endl;
-      writer->writeFromAudioSampleBuffer(buffer, 0 /* offset into buffer */, params.blockSize);
+  Group *getGroup(const String &plugin) {
+    for (int i = 0; i < groups.size(); ++i) {
+      if (groups[i]->plugin == plugin) return groups[i];
+    }
+    Group *group = new Group(plugin);
+    groups.add(group);
+    return group;
+  }
+
+  Item *takeNext(Group &group) {
+    const ScopedLock sl(lock);
+    return group.nextItem < group.items.size() ? group.items[group.nextItem++] : nullptr;
+  }
+
+  void finish(Item *item, bool result) {
+    item->result = result;
+    {
+      const ScopedLock sl(lock);
+      completed.add(item);
+      --numPending;
     }
+    itemCompleted.signal();
+  }
 
-    instance->reset();
+  CriticalSection lock;
+  OwnedArray<Group> groups;
+  Array<Item *> completed;
+  int numPending;
+  WaitableEvent itemCompleted;
+  OwnedArray<Lane> lanes;
 
+  JUCE_DECLARE_NON_COPYABLE(RenderBatch)
+};
+
+// Keeps every block of one voice, to be mixed once all voices are done.
+class VoiceSink : public AudioBlockSink {
+public:
+  VoiceSink() {}
+
+  bool writeBlock(const AudioSampleBuffer &buffer, int numSamples) {
+    AudioSampleBuffer *block = new AudioSampleBuffer(buffer.getNumChannels(), numSamples);
+    for (int ch = 0; ch < buffer.getNumChannels(); ++ch) block->copyFrom(ch, 0, buffer, ch, 0, numSamples);
+    blocks.add(block);
     return true;
   }
-}
 
-static int beginRequestHandler(struct mg_connection *conn) {
-  enum BeginRequestHandlerReturnValues { HANDLED = 1, NOT_HANDLED = 0 };
+  OwnedArray<AudioSampleBuffer> blocks;
 
-  struct mg_request_info *info = mg_get_request_info(conn);
-  String uri(info->uri);
-  if (!uri.endsWithIgnoreCase(".json") && !uri.endsWithIgnoreCase(".wav")) {
-    // DBG << "Not handling as audio request" << endl;
-    return NOT_HANDLED;
+private:
+  JUCE_DECLARE_NON_COPYABLE(VoiceSink)
+};
+
+// Renders each note of the request on its own instance, as a batch, and sums the voices.
+bool handleVoicesInParallel(const PluginRequestParameters &params, OutputStream &ostream, AudioBlockSink *sink) {
+  DynamicObject *batchObj = new DynamicObject(); // freed when batchVar leaves scope
+  var batchVar(batchObj), requests;
+  const Array<var> *notes = params.request["notes"].getArray();
+  for (int i = 0; i < notes->size(); ++i) {
+    DynamicObject *voice = new DynamicObject();
+    var voiceNotes;
+    voiceNotes.append(notes->getReference(i));
+    voice->setProperty("notes", voiceNotes);
+    voice->setProperty("effects", var::null); // the caller's sink already runs the effects over the mix
+    requests.append(var(voice));
   }
+  const NamedValueSet &fields = params.request.getDynamicObject()->getProperties();
+  for (int i = 0; i < fields.size(); ++i) batchObj->setProperty(fields.getName(i), fields.getValueAt(i));
+  batchObj->setProperty("requests", requests);
 
-  // DBG << "Handling URI: " << uri << endl;
+  RenderBatch batch(batchVar);
+  OwnedArray<VoiceSink> voices;
+  for (int i = 0; i < batch.size(); ++i) {
+    voices.add(new VoiceSink());
+    batch.setSink(i, voices[i]);
+  }
+  batch.start(serverOptions.batchMaxLanes);
+  bool result = true;
+  while (RenderBatch::Item *item = batch.waitForNextResult()) {
+    if (!item->result) result = false;
+  }
+  if (!result) return false;
+
+  ScopedPointer<AudioBlockSink> encoder;
+  if (!sink) {
+    encoder = createEncodingSink(params, ostream);
+    if (!encoder) return false;
+    sink = encoder;
+  }
+
+  // Voices are summed in note order, so that the mix does not depend on which finished first.
+  for (int b = 0; b < voices[0]->blocks.size(); ++b) {
+    AudioSampleBuffer &mix = *voices[0]->blocks[b];
+    for (int v = 1; v < voices.size(); ++v) {
+      if (b >= voices[v]->blocks.size()) continue;
+      const AudioSampleBuffer &voice = *voices[v]->blocks[b];
+      int numSamples = jmin(mix.getNumSamples(), voice.getNumSamples());
+      for (int ch = 0; ch < jmin(mix.getNumChannels(), voice.getNumChannels()); ++ch) {
+        FloatVectorOperations::add(mix.getSampleData(ch), voice.getSampleData(ch), numSamples);
+      }
+    }
+    if (!sink->writeBlock(mix, mix.getNumSamples())) return false;
+  }
+  return true;
+}
 
+// Reads a request's JSON from the query string, or failing that, from the POST data.
+// POST data that is a standard MIDI file is added to the query string's request as "midiData".
+static var parseRequestJSON(struct mg_connection *conn, const struct mg_request_info *info) {
   var parsed;
   // First try to look in the query string
   String queryString = urldecode(info->query_string);
   // DBG << queryString << endl;
   parsed = JSON::parse(queryString);
   // Otherwise look in the POST data
-  if (!parsed) {
+  if (!parsed || String(info->request_method) == "POST") {
     MemoryBlock postDataBlock;
     char postBuffer[1024];
     int didRead;
     while ((didRead = mg_read(conn, postBuffer, sizeof(postBuffer)))) {
       postDataBlock.append(postBuffer, didRead);
     }
-    MemoryInputStream postStream(postDataBlock, false);
-    parsed = JSON::parse(postStream);
+    if (postDataBlock.getSize() >= 4 && memcmp(postDataBlock.getData(), "MThd", 4) == 0) {
+      if (!parsed.getDynamicObject()) parsed = var(new DynamicObject());
+      parsed.getDynamicObject()->setProperty("midiData", base64encode(postDataBlock));
+    }
+    else if (!parsed) {
+      MemoryInputStream postStream(postDataBlock, false);
+      parsed = JSON::parse(postStream);
+    }
+  }
+  return parsed;
+}
+
+// Renders a batch, sending each result as one part of a multipart/mixed response as soon as it
+// completes. Parts are in completion order; each carries its index in the batch and its status.
+static void handleBatchRequest(struct mg_connection *conn, const var &parsed) {
+  RenderBatch batch(parsed);
+  int64 startTime = Time::currentTimeMillis();
+  batch.start(serverOptions.batchMaxLanes);
+
+  // The length is unknown until the end, so the response is delimited by closing the connection.
+  String boundary = "batch-" + String::toHexString(Random::getSystemRandom().nextInt64());
+  mg_printf(conn, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: multipart/mixed; boundary=%s\r\n"
+            "\r\n",
+            boundary.toRawUTF8());
+
+  while (RenderBatch::Item *item = batch.waitForNextResult()) {
+    const void *data = item->result ? item->output->getData() : nullptr;
+    int size = item->result ? (int)item->output->getDataSize() : 0;
+    String partHeader = "--" + boundary + "\r\n"
+      + "Content-Type: " + (item->result ? item->params.getContentType() : "text/plain") + "\r\n"
+      + "Content-Length: " + String(size) + "\r\n"
+      + "X-Render-Index: " + String(item->index) + "\r\n"
+      + "X-Render-Status: " + (item->result ? "200" : "500") + "\r\n"
+      + "\r\n";
+    if (mg_write(conn, partHeader.toRawUTF8(), partHeader.getNumBytesAsUTF8()) <= 0
+        || (size > 0 && mg_write(conn, data, size) <= 0)
+        || mg_write(conn, "\r\n", 2) <= 0) {
+      DBG << "-> Client went away during batch" << endl;
+      return; // the batch's destructor stops its lanes
+    }
+    item->output = nullptr; // sent, so a long batch only holds the results still waiting to go out
+  }
+  mg_printf(conn, "--%s--\r\n", boundary.toRawUTF8());
+  DBG << "-> Rendered batch of " << batch.size() << " requests in " << (Time::currentTimeMillis() - startTime) << "ms" << endl;
+}
+
+// Identifies a render by everything that determines its bytes: the fully resolved request, and the
+// versions of the plugins it uses, in order, which name them as resolved by the registry. Empty if a
+// plugin is unknown, in which case nothing is cached.
+static String getRenderCacheKey(const PluginRequestParameters &params) {
+  StringArray versions;
+  versions.add(pluginRegistry.getVersion(params.plugin));
+  for (int i = 0; i < params.effects.size(); ++i) {
+    versions.add(pluginRegistry.getVersion(params.effects.getReference(i).plugin));
+  }
+  if (versions.contains(String::empty)) return String::empty;
+  return RenderCache::hashKey(versions.joinIntoString("|") + "\n" + params.getCanonicalDescription());
+}
+
+// Sends a whole response that is already in memory.
+static void sendResponse(struct mg_connection *conn, const char *contentType, const void *data, size_t size) {
+  mg_printf(conn, "HTTP/1.0 200 OK\r\n"
+            "Content-Length: %d\r\n"
+            "Content-Type: %s\r\n"
+            "\r\n",
+            (int)size, contentType);
+  mg_write(conn, data, size);
+}
+
+// Keeps a finished render in both cache tiers, whichever are enabled.
+static void cacheRender(const String &key, const PluginRequestParameters &params, const void *data, size_t size) {
+  renderCache.put(key, data, size);
+  renderFileCache.put(key, params.getFormatName(), data, size);
+}
+
+static int beginRequestHandler(struct mg_connection *conn) {
+  enum BeginRequestHandlerReturnValues { HANDLED = 1, NOT_HANDLED = 0 };
+
+  struct mg_request_info *info = mg_get_request_info(conn);
+  String uri(info->uri);
+  bool isBatch = uri.equalsIgnoreCase("/batch");
+  if (!isBatch && !uri.endsWithIgnoreCase(".json") && !uri.endsWithIgnoreCase(".wav")) {
+    // DBG << "Not handling as audio request" << endl;
+    return NOT_HANDLED;
   }
 
-  DBG << "Request JSON: " << JSON::toString(parsed, true) << endl;
+  // DBG << "Handling URI: " << uri << endl;
+
+  var parsed = parseRequestJSON(conn, info);
+
+  // The preview endpoint is the same as setting "preview", which then also reaches worker processes.
+  if (uri.endsWithIgnoreCase("/preview.wav")) {
+    if (!parsed.getDynamicObject()) parsed = var(new DynamicObject());
+    parsed.getDynamicObject()->setProperty("preview", true);
+  }
+
+  DBG << "Request JSON: " << JSON::toString(parsed, true).substring(0, 1000) << endl;
+
+  if (isBatch) {
+    handleBatchRequest(conn, parsed);
+    return HANDLED;
+  }
 
   PluginRequestParameters params(parsed);
   if (uri.endsWithIgnoreCase(".json")) {
     params.listParameters = true;
   }
 
+  // Renders are cached by content, so that an identical request is answered without touching a plugin.
+  // Memory is checked first, then disk, whose files mongoose serves like static ones, with Range support.
+  String cacheKey;
+  if (!params.listParameters) cacheKey = getRenderCacheKey(params);
+  if (cacheKey.isNotEmpty()) {
+    if (RenderCache::Render::Ptr cached = renderCache.get(cacheKey)) {
+      DBG << "-> Served from render cache" << endl;
+      sendResponse(conn, params.getContentType(), cached->data.getData(), cached->data.getSize());
+      return HANDLED;
+    }
+    File cachedFile = renderFileCache.get(cacheKey, params.getFormatName());
+    if (cachedFile.existsAsFile()) {
+      DBG << "-> Served from render cache directory" << endl;
+      mg_send_file(conn, cachedFile.getFullPathName().toRawUTF8());
+      return HANDLED;
+    }
+  }
+
+  // An identical render already in progress is waited for, rather than rendered again. A follower waits
+  // no longer than it would for an instance, after which it renders on its own.
+  RenderFlights::Flight::Ptr flight;
+  bool isLeader = true;
+  if (cacheKey.isNotEmpty()) flight = renderFlights.join(cacheKey, isLeader);
+  if (!isLeader) {
+    DBG << "-> Waiting for an identical render in progress" << endl;
+    if (flight->done.wait(params.timeoutMillis)) {
+      if (!flight->succeeded) {
+        DBG << "-> Unable to handle plugin request!" << endl;
+        mg_printf(conn, "HTTP/1.0 500 ERROR\r\n\r\n");
+        return HANDLED;
+      }
+      sendResponse(conn, params.getContentType(), flight->data.getData(), flight->data.getSize());
+      return HANDLED;
+    }
+    DBG << "-> Still rendering after " << params.timeoutMillis << "ms; rendering again" << endl;
+    renderFlights.leave(flight);
+    flight = nullptr;
+  }
+  RenderFlights::Lead lead(renderFlights, flight);
+
+  // Audio of a known length is sent as each block comes out of the plugin, so that clients can start
+  // playing right away. Renders that end on silence have no length until they end, so they are
+  // buffered like the JSON listing.
+  if (!params.listParameters && !params.endOnSilence && WavStreamSink::supportsBitDepth(params.bitDepth)) {
+    int64 numFrames = (int64)params.getNumBlocks() * params.blockSize;
+    int64 fileSize = WavStreamSink::getFileSize(params.nChannels, params.bitDepth, numFrames);
+    String headers = "HTTP/1.0 200 OK\r\n"
+      "Content-Length: " + String(fileSize) + "\r\n"
+      "Content-Type: " + params.getContentType() + "\r\n"
+      "\r\n";
+    MongooseOutputStream connectionStream(conn, headers);
+    // The audio is only copied as it goes out if a cache or an identical request needs it.
+    bool cached = cacheKey.isNotEmpty() && (renderCache.isEnabled() || renderFileCache.isEnabled());
+    RenderFlights::Capture responseStream(renderFlights, flight, connectionStream, (size_t)fileSize, cached);
+    // Render threads hand the audio back to this thread to send, so a slow client never holds one up
+    // for longer than it takes to fill the buffer.
+    HandoffOutputStream handoff(responseStream, (size_t)serverOptions.streamBufferKB * 1024);
+    OutputStream &ostream = renderThreads.isEnabled() ? (OutputStream &)handoff : responseStream;
+    WavStreamSink sink(ostream, params.sampleRate, params.nChannels, params.bitDepth, numFrames);
+
+    int64 startTime = Time::currentTimeMillis();
+    if (!handlePluginRequest(params, ostream, &sink) || !sink.finish()) {
+      DBG << "-> Unable to handle plugin request!" << endl;
+      // Once audio has gone out, the status cannot change; the connection closes short of Content-Length.
+      if (!connectionStream.hasStarted()) mg_printf(conn, "HTTP/1.0 500 ERROR\r\n\r\n");
+      return HANDLED;
+    }
+    DBG << "-> Streamed plugin request in " << (Time::currentTimeMillis() - startTime) << "ms" << endl;
+    if (responseStream.isCopying()) {
+      // Followers are answered before the copy is cached, which may mean writing it to disk.
+      const MemoryOutputStream &copy = responseStream.getCopy();
+      lead.succeed(copy.getData(), copy.getDataSize());
+      cacheRender(cacheKey, params, copy.getData(), copy.getDataSize());
+    }
+    return HANDLED;
+  }
+
+  // Buffered audio is at most the full-length file, so reserve that up front rather than growing as it is written.
   MemoryBlock block;
+  if (!params.listParameters) {
+    block.ensureSize((size_t)WavStreamSink::getFileSize(params.nChannels, params.bitDepth,
+                                                        (int64)params.getNumBlocks() * params.blockSize));
+  }
   MemoryOutputStream ostream(block, false);
 
   // DBG << "Rendering plugin request" << endl;
@@ -328,30 +1612,92 @@ static int beginRequestHandler(struct mg_connection *conn) {
   
   // Note: MemoryOutputStream::getDataSize() is the actual number of bytes written.
   // Do not use MemoryBlock::getSize() since this reports the memory allocated (but not initialized!)
-  mg_printf(conn, "HTTP/1.0 200 OK\r\n"
-            "Content-Length: %d\r\n"
-            "Content-Type: %s\r\n"
-            "\r\n",
-            (int)ostream.getDataSize(), params.getContentType());
-  mg_write(conn, ostream.getData(), ostream.getDataSize());
+  // The render is cached only once everyone waiting on it has been answered, since caching it may
+  // mean writing it to disk.
+  lead.succeed(ostream.getData(), ostream.getDataSize());
+  sendResponse(conn, params.getContentType(), ostream.getData(), ostream.getDataSize());
+  if (cacheKey.isNotEmpty()) cacheRender(cacheKey, params, ostream.getData(), ostream.getDataSize());
 
   return HANDLED;
 }
 
+// Registers the configured plugins, without loading any. With worker processes, the server still
+// registers them, so that it knows which plugin versions renders use.
+static void registerPlugins() {
+  pluginDescriptionCache.setFile(File(resolveRelativePath(serverOptions.pluginCacheFile)));
+  pluginRegistry.setBaseDirectory(cwd);
+
+  // Read the plugin descriptions, falling back to the single built-in plugin.
+  {
+    PluginSettings defaults = serverOptions.getPluginSettings();
+    File configDir(resolveRelativePath(serverOptions.pluginConfigDir));
+    int numPlugins = pluginRegistry.addFromDirectory(configDir, defaults, createSynthInstance);
+    if (numPlugins == 0) {
+      DynamicObject *config = new DynamicObject(); // freed when configVar leaves scope
+      var configVar(config);
+      config->setProperty("path", PLUGIN_REL_PATH);
+      config->setProperty("preload", true);
+      pluginRegistry.add(new PluginEntry(configVar, "default", defaults, createSynthInstance));
+      numPlugins = 1;
+    }
+    DBG << "Registered " << numPlugins << " plugins" << endl;
+    pluginRegistry.setMemoryBudgetMB(serverOptions.pluginMemoryBudgetMB);
+  }
+}
+
+// Starts the render machinery and loads the preloaded plugins. Returns false if any fail to load.
+static bool loadPlugins() {
+  if (serverOptions.renderThreads > 0) {
+    DBG << "Starting " << serverOptions.renderThreads << " render threads" << endl;
+    renderThreads.start(serverOptions.renderThreads, serverOptions.renderThreadsPinned);
+  }
+
+  if (serverOptions.watchdogRealtimeFactor > 0) {
+    renderWatchdog.start(serverOptions.watchdogRealtimeFactor, serverOptions.watchdogMinBlockMillis);
+  }
+
+  // Load preloaded plugins now; the rest are loaded on first use.
+  DBG << "Loading plugins..." << endl;
+  return pluginRegistry.preload();
+}
+
 int main (int argc, char *argv[]) {
+  AllocationCounter::install();
   Logger::setCurrentLogger(&DEBUG_LOGGER);
+  outputFormats.registerBasicFormats();
 
-  #if 1 // Always load one instance to the pool to keep the plugin in cache
-  // Consider testing PLUGIN_POOL_SIZE
-  {
-    DBG << "Loading plugin..." << endl;
-    int poolSize = PLUGIN_POOL_SIZE;
-    if (poolSize < 1) poolSize = 1;
-    for (int numPlugs = 0; numPlugs < poolSize; ++numPlugs) {
-      pluginPool.add(new ThreadSafePlugin(createSynthInstance()));
+  serverOptions = ServerOptions(ServerOptions::parseCommandLine(argc, argv));
+  StringArray serverArguments;
+  for (int i = 1; i < argc; ++i) serverArguments.add(argv[i]);
+
+  registerPlugins();
+  renderCache.setBudgetBytes((int64)serverOptions.renderCacheMB * 1024 * 1024);
+  if (serverOptions.renderCacheDir.isNotEmpty()) {
+    renderFileCache.setDirectory(File(resolveRelativePath(serverOptions.renderCacheDir)));
+  }
+
+  // With worker processes, this process only serves HTTP, and never loads plugins itself.
+  if (serverOptions.workerProcesses > 0 && serverOptions.workerPipe.isEmpty()) {
+    DBG << "Starting " << serverOptions.workerProcesses << " worker processes" << endl;
+    if (!workerPool.start(serverOptions.workerProcesses, serverArguments, serverOptions.workerRingFrames,
+                          serverOptions.workerMaxChannels, serverOptions.workerJobTimeoutMillis)) {
+      DBG << "Unable to start worker processes" << endl;
+      return 1;
+    }
+  }
+  else {
+    if (!loadPlugins()) return 1;
+
+    // A worker serves its server's jobs instead of HTTP, and exits when the server goes away.
+    if (serverOptions.workerPipe.isNotEmpty()) {
+      WorkerClient client(File(serverOptions.workerRing), handleWorkerRequest);
+      int exitCode = client.run(serverOptions.workerPipe);
+      pluginRegistry.unloadAll();
+      renderThreads.stop();
+      renderWatchdog.stop();
+      return exitCode;
     }
   }
-  #endif
 
   // Test: fire a request manually
   /*
@@ -367,9 +1713,12 @@ int main (int argc, char *argv[]) {
   */
 
   struct mg_context *ctx;
+  String numThreads(serverOptions.httpThreads);
   const char *options[] = {
     "document_root", "public",
     "listening_ports", "8080",
+    "num_threads", numThreads.toRawUTF8(),
+    "extra_mime_types", ".wav=audio/vnw.wave", // as rendered responses, including those served from disk
     NULL
   };
   struct mg_callbacks callbacks;
@@ -381,6 +1730,10 @@ int main (int argc, char *argv[]) {
   getchar();  // Wait until user hits "enter"
   DBG << "Shutting down server threads" << endl;
   mg_stop(ctx);
+  workerPool.stop();
+  pluginRegistry.unloadAll();
+  renderThreads.stop();
+  renderWatchdog.stop();
   DBG << "Exiting" << endl;
   return 0;
 }
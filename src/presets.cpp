@@ -1,22 +1,25 @@
 
 #include <iostream>
 #include "JuceHeader.h"
+#include "PluginDescriptionCache.h"
 
 using namespace std;
 using namespace juce;
 
 static std::ostream &DBG = cerr;
+static PluginDescriptionCache pluginDescriptionCache;
 
 AudioPluginInstance *createSynthInstance(const char *filename = nullptr) {
   AudioPluginFormatManager pluginManager;
   pluginManager.addDefaultFormats();
 
   PluginDescription desc;
+  String path = File::getCurrentWorkingDirectory().getChildFile(filename ? filename : "plugins/FreeAlpha.vst").getFullPathName();
 
-  if (filename) desc.fileOrIdentifier = filename;
-  else desc.fileOrIdentifier = "plugins/FreeAlpha.vst";
-
-  desc.uid = 0;
+  if (!pluginDescriptionCache.getDescription(pluginManager, path, desc)) {
+    desc.fileOrIdentifier = path;
+    desc.uid = 0;
+  }
 
   String errorMessage;
   AudioPluginInstance *instance = pluginManager.createPluginInstance(desc, errorMessage);
@@ -73,6 +76,8 @@ void sampleProgram(AudioPluginInstance *instance, int program = -1) {
 int main (int argc, char *argv[]) {
   AudioPluginInstance *instance;
 
+  pluginDescriptionCache.setFile(File::getCurrentWorkingDirectory().getChildFile("cache/plugins.xml"));
+
   instance = createSynthInstance("/Library/Audio/Plug-Ins/VST/Sylenth1Demo.vst");
   DBG << endl;
   sampleProgram(instance);
@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 
 // Adapted from http://stackoverflow.com/questions/2673207/c-c-url-decode-library
 juce::String urldecode(const juce::String &str) {
@@ -43,4 +44,51 @@ juce::String urldecode(const juce::String &str) {
   return out;
 }
 
+static const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Standard (RFC 4648) base64, for binary data such as MIDI files inside JSON requests.
+juce::String base64encode(const juce::MemoryBlock &data) {
+  const unsigned char *src = static_cast<const unsigned char *>(data.getData());
+  size_t size = data.getSize();
+  juce::String out;
+  out.preallocateBytes(((size + 2) / 3) * 4 + 1);
+
+  for (size_t i = 0; i < size; i += 3) {
+    unsigned int triple = (unsigned int)src[i] << 16;
+    if (i + 1 < size) triple |= (unsigned int)src[i + 1] << 8;
+    if (i + 2 < size) triple |= src[i + 2];
+    char newChars[] = {
+      base64Alphabet[(triple >> 18) & 63],
+      base64Alphabet[(triple >> 12) & 63],
+      i + 1 < size ? base64Alphabet[(triple >> 6) & 63] : '=',
+      i + 2 < size ? base64Alphabet[triple & 63] : '=',
+      '\0'
+    };
+    out += newChars;
+  }
+  return out;
+}
+
+// Returns false if the string has characters outside the alphabet. Whitespace is skipped.
+bool base64decode(const juce::String &str, juce::MemoryBlock &out) {
+  out.setSize(0);
+  const char *src = str.toRawUTF8();
+
+  unsigned int bits = 0;
+  int numBits = 0;
+  for (; *src && *src != '='; ++src) {
+    if (isspace((unsigned char)*src)) continue;
+    const char *found = strchr(base64Alphabet, *src);
+    if (!found) return false;
+    bits = (bits << 6) | (unsigned int)(found - base64Alphabet);
+    numBits += 6;
+    if (numBits >= 8) {
+      numBits -= 8;
+      char byte = (char)((bits >> numBits) & 0xff);
+      out.append(&byte, 1);
+    }
+  }
+  return true;
+}
+
 #endif